@@ -0,0 +1,27 @@
+/**
+ * @file clones.h
+ * @author Constantin Schieber, e1228774
+ * @brief Multiversioned builds of the hot loops of the compressor
+ * @details A function that is marked with HOT_CLONES is compiled four times: for the baseline x86-64 the Makefile
+ * targets, for x86-64-v2 (SSE4.2, POPCNT), for x86-64-v3 (AVX2, BMI2, FMA) and for x86-64-v4 (AVX-512). The
+ * dynamic loader runs a resolver that picks the best variant for the CPU once (ifunc), every call goes straight to
+ * it afterwards. So one binary runs with the shifts and vector code of the host on old and new CPUs alike.
+ *
+ * The variants only differ in the code the compiler generates, the hand written kernels of the run length and the
+ * CRC-32C are chosen by rle.c and crc32c.c themselves and keep honouring MYCOMPRESS_SIMD. A cloned function is never
+ * inlined into its callers, so only functions that loop over a whole block or buffer should be marked. Other
+ * compilers, architectures and C libraries without ifunc get the plain function, as does a build with -DNO_CLONES.
+ * @date 17.10.2026
+ */
+
+#ifndef CLONES_H
+#define CLONES_H
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11 && defined(__gnu_linux__) \
+	&& !defined(NO_CLONES)
+#define HOT_CLONES __attribute__((target_clones("default", "arch=x86-64-v2", "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define HOT_CLONES
+#endif
+
+#endif
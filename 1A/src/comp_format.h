@@ -0,0 +1,105 @@
+/**
+ *  @file comp_format.h
+ *  @author Constantin Schieber, e1228774
+ *  @brief Layout of the binary .comp format (version 2)
+ *  @details A file starts with COMP_MAGIC, the version and a flags byte. The input is cut into blocks of
+ *  COMP_BLOCK_SIZE chars (the last one may be shorter), every block is stored as
+ *
+ *      mode (1 byte) | raw length (varint) | payload length (varint) | payload
+ *
+ *  and a single COMP_MODE_END byte ends the stream. Varints are unsigned LEB128, 7 bits per byte starting with the
+ *  lowest, the high bit is set on every byte except the last one. If the flags contain COMP_FLAG_CRC every payload is
+ *  followed by the CRC-32C (Castagnoli) of the raw chars of its block as a 4 byte little endian integer.
+ *
+ *  The payload of a COMP_MODE_RLE block is a sequence of tokens:
+ *    - t < 0x80:  literal, the next t + 1 chars are copied as they are
+ *    - t >= 0x80: repeat, the next char is repeated (t & 0x7f) + COMP_REPEAT_MIN times. If (t & 0x7f) is
+ *                 COMP_REPEAT_ESCAPE a varint follows the char and is added to the count.
+ *
+ *  The payload of a COMP_MODE_STORED block is the raw chars themselves, its length equals the raw length.
+ *
+ *  The payload of a COMP_MODE_HUFF block holds the same tokens, coded with a canonical Huffman code:
+ *
+ *      token length (varint) | code lengths (COMP_HUFF_TABLE_LEN bytes) | stream sizes | bit streams
+ *
+ *  The code lengths are 4 bits per char value, the low nibble of byte i belongs to 2 * i and the high nibble to
+ *  2 * i + 1. 0 means the value does not occur, no code is longer than COMP_HUFF_MAX_BITS. The codes are assigned
+ *  in the order of length and value, starting with all zero bits. The tokens are split into COMP_HUFF_STREAMS parts
+ *  of (token length + COMP_HUFF_STREAMS - 1) / COMP_HUFF_STREAMS chars, the last part gets the rest. Every part
+ *  is coded into a bit stream of its own, the sizes of all but the last one are stored as 4 byte little endian
+ *  integers. A bit stream is read from the lowest bit of every byte upwards, each code starts with its first
+ *  (highest) bit. The last byte of a stream is padded with zero bits.
+ *
+ *  If the flags contain COMP_FLAG_INDEX the end of the stream is followed by a block index and a trailer:
+ *
+ *      entries (COMP_INDEX_ENTRY_LEN each) | index offset (8 bytes) | entry count (8 bytes) | COMP_INDEX_MAGIC
+ *
+ *  Every entry is the offset of a block in the original input followed by the offset of the mode byte of that
+ *  block in the .comp file. The index offset is the offset of the first entry in the .comp file. All of them are
+ *  little endian and the entries are sorted. There is one entry every few blocks, the first one is always (0, 6).
+ *
+ *  An archive of mycompress -a holds several inputs, each of them as a complete stream of its own:
+ *
+ *      COMP_ARCHIVE_MAGIC | version (1 byte) | streams | file table | table offset (8 bytes) | entry count (8 bytes)
+ *      | COMP_TABLE_MAGIC
+ *
+ *  Every entry of the file table is
+ *
+ *      name length (varint) | name | stream offset (8 bytes) | stream length (8 bytes) | raw length (8 bytes)
+ *
+ *  in the order of the command line. Offsets are relative to the start of the archive, the table offset is the
+ *  offset of the first entry. All integers are little endian.
+ *
+ *  The legacy format always has a digit as its second char, so it never starts with COMP_MAGIC or
+ *  COMP_ARCHIVE_MAGIC.
+ *  @date 17.10.2026
+ * */
+
+#ifndef COMP_FORMAT_H
+#define COMP_FORMAT_H
+
+#define COMP_MAGIC ("MCMP")
+#define COMP_MAGIC_LEN (4)
+#define COMP_VERSION (2)
+#define COMP_HEADER_LEN (COMP_MAGIC_LEN + 2)
+
+#define COMP_FLAG_INDEX (0x01)
+#define COMP_FLAG_CRC (0x02)
+#define COMP_FLAGS_KNOWN (COMP_FLAG_INDEX | COMP_FLAG_CRC)
+
+#define COMP_ARCHIVE_MAGIC ("MCAR")
+#define COMP_ARCHIVE_VERSION (1)
+#define COMP_ARCHIVE_HEADER_LEN (COMP_MAGIC_LEN + 1)
+#define COMP_TABLE_MAGIC ("MCAT")
+
+#define COMP_INDEX_MAGIC ("MCIX")
+#define COMP_INDEX_ENTRY_LEN (16)
+#define COMP_TRAILER_LEN (16 + COMP_MAGIC_LEN)
+
+#define COMP_BLOCK_SIZE (1 << 20)
+
+#define COMP_MODE_END (0x00)
+#define COMP_MODE_RLE (0x01)
+#define COMP_MODE_HUFF (0x02)
+#define COMP_MODE_STORED (0x03)
+
+#define COMP_LITERAL_MAX (128)
+#define COMP_REPEAT_FLAG (0x80)
+#define COMP_REPEAT_MIN (2)
+#define COMP_REPEAT_ESCAPE (0x7f)
+
+#define COMP_HUFF_MAX_BITS (11)
+#define COMP_HUFF_TABLE_LEN (128)
+#define COMP_HUFF_STREAMS (4)
+
+#define COMP_VARINT_MAX (10)
+#define COMP_BLOCK_HEADER_MAX (1 + 2 * COMP_VARINT_MAX)
+#define COMP_CRC_LEN (4)
+
+/* Largest payload of a block with n chars: one literal token per COMP_LITERAL_MAX chars, plus one */
+#define COMP_PAYLOAD_BOUND(n) ((n) + (n) / COMP_LITERAL_MAX + 1)
+
+/* Largest encoded block with n chars, including its CRC */
+#define COMP_BLOCK_BOUND(n) (COMP_BLOCK_HEADER_MAX + COMP_PAYLOAD_BOUND(n) + COMP_CRC_LEN)
+
+#endif
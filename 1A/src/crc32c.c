@@ -0,0 +1,474 @@
+/**
+ * @file crc32c.c
+ * @author Constantin Schieber, e1228774
+ * @brief CRC-32C (Castagnoli), see crc32c.h
+ * @details The crc32 instruction has a latency of three cycles but can start one every cycle, so the SSE4.2
+ * version runs three CRCs over three neighbouring parts of the input at once. The CRCs of the first two parts are
+ * then shifted over the zeros that stand for the following parts and combined with the next one. The shift is a
+ * multiplication with a 32 x 32 matrix over GF(2), it is precomputed for the two part lengths as four tables of 256
+ * entries each.
+ *
+ * Even then crc32 does no more than eight chars per cycle. CPUs with AVX-512 and VPCLMULQDQ fold the input instead:
+ * 16 lanes of 128 bits are multiplied carry-less with x^2048 mod P and the next 256 chars are added, which keeps the
+ * remainder modulo P the same. At the end the lanes are folded into one and its 16 chars go through crc32.
+ * @date 17.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#define HAVE_X86_CRC
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+/* === Constants === */
+
+/* The CRC-32C polynomial, bit reversed */
+#define POLY (0x82f63b78)
+
+/* The CRC-32C polynomial without x^32, not reversed */
+#define POLY_NORMAL (0x1edc6f41)
+
+/* Lengths of the three parts the hardware version computes at once, LONG_LEN for large inputs and SHORT_LEN for the
+ * rest. Both have to be powers of two.
+ */
+#define LONG_LEN (8192)
+#define SHORT_LEN (256)
+
+/* Chars the folding version consumes at once, shorter inputs go to the SSE4.2 version */
+#define FOLD_LEN (256)
+
+/* === Global Variables === */
+
+/* Slicing-by-8 tables, table[k][c] is the CRC of c followed by k zeros */
+static uint32_t table[8][256];
+
+#ifdef HAVE_X86_CRC
+/* Operators that shift a CRC over LONG_LEN and SHORT_LEN zeros, one table per byte of the CRC */
+static uint32_t long_shift[4][256];
+static uint32_t short_shift[4][256];
+
+/* Constants that fold a 128 bit lane over 2048, 512, 384, 256 and 128 bits, the first one multiplies the low and
+ * the second one the high half of the lane
+ */
+static uint64_t fold_2048[2], fold_512[2], fold_384[2], fold_256[2], fold_128[2];
+#endif
+
+/* The version in use */
+static uint32_t (*crc_update) (uint32_t crc, const unsigned char *buf, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* === Prototypes === */
+
+/**
+ * @brief Portable version of crc_update, works on eight chars at a time with the slicing-by-8 table
+ * @param crc The inverted CRC of the chars before
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @return The inverted CRC of all chars so far
+ */
+static uint32_t crc_update_table (uint32_t crc, const unsigned char *buf, size_t len);
+
+#ifdef HAVE_X86_CRC
+/**
+ * @brief SSE4.2 version of crc_update_table()
+ */
+static uint32_t crc_update_sse42 (uint32_t crc, const unsigned char *buf, size_t len);
+
+/**
+ * @brief AVX-512 version of crc_update_table(), folds the input and leaves the rest to crc_update_sse42()
+ */
+static uint32_t crc_update_vpclmul (uint32_t crc, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Folds every 128 bit lane of x over the distance of k and adds next
+ * @param x The lanes
+ * @param k The constants of the distance in every lane
+ * @param next The lanes at that distance
+ * @return The folded lanes
+ */
+static __m512i fold_lanes (__m512i x, __m512i k, __m512i next);
+
+/**
+ * @brief Folds one 128 bit lane over the distance of k
+ * @param x The lane
+ * @param k The constants of the distance
+ * @return The folded lane
+ */
+static __m128i fold_lane (__m128i x, const uint64_t k[2]);
+
+/**
+ * @brief Computes the fold constants of a distance
+ * @param k Set to x^(bits + 32) mod P and x^(bits - 32) mod P, both reversed and shifted left by one
+ * @param bits The distance
+ */
+static void build_fold (uint64_t k[2], unsigned int bits);
+
+/**
+ * @brief Shifts a CRC over the zeros of one of the shift tables
+ * @param shift The tables of the operator
+ * @param crc The CRC
+ * @return The shifted CRC
+ */
+static uint32_t crc_shift (uint32_t shift[4][256], uint32_t crc);
+
+/**
+ * @brief Builds the tables of the operator that shifts a CRC over len zeros
+ * @param shift The tables
+ * @param len The amount of zeros, a power of two
+ */
+static void build_shift (uint32_t shift[4][256], size_t len);
+
+/**
+ * @brief Multiplies a vector with a matrix over GF(2)
+ * @param mat The 32 columns of the matrix
+ * @param vec The vector
+ * @return The product
+ */
+static uint32_t gf2_times (const uint32_t *mat, uint32_t vec);
+
+/**
+ * @brief Squares a matrix over GF(2)
+ * @param square Set to the square, 32 columns
+ * @param mat The 32 columns of the matrix
+ */
+static void gf2_square (uint32_t *square, const uint32_t *mat);
+#endif
+
+/**
+ * @brief Builds the tables and sets crc_update to the fastest version the CPU supports
+ * @details MYCOMPRESS_SIMD set to scalar forces the table, any other variant but avx512 the SSE4.2 version.
+ */
+static void select_crc (void);
+
+/* === Interface === */
+
+uint32_t crc32c (uint32_t crc, const void *buf, size_t len)
+{
+	(void) pthread_once (&crc_once, select_crc);
+
+	return ~crc_update (~crc, buf, len);
+}
+
+/* === Implementations === */
+
+static uint32_t crc_update_table (uint32_t crc, const unsigned char *buf, size_t len)
+{
+	while (len > 0 && ((uintptr_t) buf & 7) != 0)
+	{
+		crc = table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	/* The chars are put together one by one, that keeps it independent of the byte order */
+	for (; len >= 8; buf += 8, len -= 8)
+	{
+		crc ^= (uint32_t) buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+		crc = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff] ^ table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24]
+			^ table[3][buf[4]] ^ table[2][buf[5]] ^ table[1][buf[6]] ^ table[0][buf[7]];
+	}
+
+	while (len > 0)
+	{
+		crc = table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	return crc;
+}
+
+#ifdef HAVE_X86_CRC
+__attribute__((target("sse4.2")))
+static uint32_t crc_update_sse42 (uint32_t crc, const unsigned char *buf, size_t len)
+{
+	uint64_t crc0 = crc, crc1, crc2, a, b, c;
+	const unsigned char *end;
+
+	while (len > 0 && ((uintptr_t) buf & 7) != 0)
+	{
+		crc0 = _mm_crc32_u8 ((uint32_t) crc0, *buf++);
+		len--;
+	}
+
+	/* Three parts at once, first of LONG_LEN chars and then of SHORT_LEN chars */
+	while (len >= 3 * LONG_LEN)
+	{
+		crc1 = 0;
+		crc2 = 0;
+		for (end = buf + LONG_LEN; buf < end; buf += 8)
+		{
+			(void) memcpy (&a, buf, 8);
+			(void) memcpy (&b, buf + LONG_LEN, 8);
+			(void) memcpy (&c, buf + 2 * LONG_LEN, 8);
+			crc0 = _mm_crc32_u64 (crc0, a);
+			crc1 = _mm_crc32_u64 (crc1, b);
+			crc2 = _mm_crc32_u64 (crc2, c);
+		}
+		crc0 = crc_shift (long_shift, (uint32_t) crc0) ^ crc1;
+		crc0 = crc_shift (long_shift, (uint32_t) crc0) ^ crc2;
+		buf += 2 * LONG_LEN;
+		len -= 3 * LONG_LEN;
+	}
+	while (len >= 3 * SHORT_LEN)
+	{
+		crc1 = 0;
+		crc2 = 0;
+		for (end = buf + SHORT_LEN; buf < end; buf += 8)
+		{
+			(void) memcpy (&a, buf, 8);
+			(void) memcpy (&b, buf + SHORT_LEN, 8);
+			(void) memcpy (&c, buf + 2 * SHORT_LEN, 8);
+			crc0 = _mm_crc32_u64 (crc0, a);
+			crc1 = _mm_crc32_u64 (crc1, b);
+			crc2 = _mm_crc32_u64 (crc2, c);
+		}
+		crc0 = crc_shift (short_shift, (uint32_t) crc0) ^ crc1;
+		crc0 = crc_shift (short_shift, (uint32_t) crc0) ^ crc2;
+		buf += 2 * SHORT_LEN;
+		len -= 3 * SHORT_LEN;
+	}
+
+	for (; len >= 8; buf += 8, len -= 8)
+	{
+		(void) memcpy (&a, buf, 8);
+		crc0 = _mm_crc32_u64 (crc0, a);
+	}
+	while (len > 0)
+	{
+		crc0 = _mm_crc32_u8 ((uint32_t) crc0, *buf++);
+		len--;
+	}
+
+	return (uint32_t) crc0;
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2")))
+static uint32_t crc_update_vpclmul (uint32_t crc, const unsigned char *buf, size_t len)
+{
+	__m512i k2048, k512, x0, x1, x2, x3;
+	__m128i lane;
+	uint64_t sum;
+
+	if (len < FOLD_LEN)
+	{
+		return crc_update_sse42 (crc, buf, len);
+	}
+
+	/* Four accumulators of four lanes each, the CRC so far is added to the first chars */
+	k2048 = _mm512_broadcast_i32x4 (_mm_set_epi64x ((long long) fold_2048[1], (long long) fold_2048[0]));
+	k512 = _mm512_broadcast_i32x4 (_mm_set_epi64x ((long long) fold_512[1], (long long) fold_512[0]));
+	x0 = _mm512_xor_si512 (_mm512_loadu_si512 (buf), _mm512_castsi128_si512 (_mm_cvtsi32_si128 ((int) crc)));
+	x1 = _mm512_loadu_si512 (buf + 64);
+	x2 = _mm512_loadu_si512 (buf + 128);
+	x3 = _mm512_loadu_si512 (buf + 192);
+	buf += FOLD_LEN;
+	len -= FOLD_LEN;
+
+	/* fold_lanes() spelled out, this loop does all the work */
+	for (; len >= FOLD_LEN; buf += FOLD_LEN, len -= FOLD_LEN)
+	{
+		x0 = _mm512_ternarylogic_epi64 (_mm512_clmulepi64_epi128 (x0, k2048, 0x00),
+			_mm512_clmulepi64_epi128 (x0, k2048, 0x11), _mm512_loadu_si512 (buf), 0x96);
+		x1 = _mm512_ternarylogic_epi64 (_mm512_clmulepi64_epi128 (x1, k2048, 0x00),
+			_mm512_clmulepi64_epi128 (x1, k2048, 0x11), _mm512_loadu_si512 (buf + 64), 0x96);
+		x2 = _mm512_ternarylogic_epi64 (_mm512_clmulepi64_epi128 (x2, k2048, 0x00),
+			_mm512_clmulepi64_epi128 (x2, k2048, 0x11), _mm512_loadu_si512 (buf + 128), 0x96);
+		x3 = _mm512_ternarylogic_epi64 (_mm512_clmulepi64_epi128 (x3, k2048, 0x00),
+			_mm512_clmulepi64_epi128 (x3, k2048, 0x11), _mm512_loadu_si512 (buf + 192), 0x96);
+	}
+
+	/* Into one accumulator, which takes the rest of 64 chars each */
+	x0 = fold_lanes (x0, k512, x1);
+	x0 = fold_lanes (x0, k512, x2);
+	x0 = fold_lanes (x0, k512, x3);
+	for (; len >= 64; buf += 64, len -= 64)
+	{
+		x0 = fold_lanes (x0, k512, _mm512_loadu_si512 (buf));
+	}
+
+	/* Into one lane, its CRC is the CRC of everything folded */
+	lane = _mm_xor_si128 (fold_lane (_mm512_extracti32x4_epi32 (x0, 0), fold_384),
+		fold_lane (_mm512_extracti32x4_epi32 (x0, 1), fold_256));
+	lane = _mm_xor_si128 (lane, fold_lane (_mm512_extracti32x4_epi32 (x0, 2), fold_128));
+	lane = _mm_xor_si128 (lane, _mm512_extracti32x4_epi32 (x0, 3));
+	sum = _mm_crc32_u64 (0, (uint64_t) _mm_cvtsi128_si64 (lane));
+	sum = _mm_crc32_u64 (sum, (uint64_t) _mm_extract_epi64 (lane, 1));
+
+	return crc_update_sse42 ((uint32_t) sum, buf, len);
+}
+
+__attribute__((target("avx512f,vpclmulqdq")))
+static __m512i fold_lanes (__m512i x, __m512i k, __m512i next)
+{
+	return _mm512_ternarylogic_epi64 (_mm512_clmulepi64_epi128 (x, k, 0x00), _mm512_clmulepi64_epi128 (x, k, 0x11),
+		next, 0x96);
+}
+
+__attribute__((target("pclmul")))
+static __m128i fold_lane (__m128i x, const uint64_t k[2])
+{
+	__m128i c = _mm_set_epi64x ((long long) k[1], (long long) k[0]);
+
+	return _mm_xor_si128 (_mm_clmulepi64_si128 (x, c, 0x00), _mm_clmulepi64_si128 (x, c, 0x11));
+}
+
+static void build_fold (uint64_t k[2], unsigned int bits)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		unsigned int n = i == 0 ? bits + 32 : bits - 32;
+		uint32_t rem = 1, rev = 0;
+
+		for (; n > 0; n--)
+		{
+			rem = (rem & 0x80000000) != 0 ? (rem << 1) ^ POLY_NORMAL : rem << 1;
+		}
+		for (int b = 0; b < 32; b++)
+		{
+			rev |= ((rem >> b) & 1) << (31 - b);
+		}
+		k[i] = (uint64_t) rev << 1;
+	}
+}
+
+static uint32_t crc_shift (uint32_t shift[4][256], uint32_t crc)
+{
+	return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+static void build_shift (uint32_t shift[4][256], size_t len)
+{
+	uint32_t even[32], odd[32], row = 1;
+	uint32_t *op = even;
+	int n;
+
+	/* The operator for one zero bit */
+	odd[0] = POLY;
+	for (n = 1; n < 32; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* Two and four zero bits, then every square doubles the zero bytes until len is reached */
+	gf2_square (even, odd);
+	gf2_square (odd, even);
+	for (;;)
+	{
+		gf2_square (even, odd);
+		op = even;
+		if ((len >>= 1) == 0)
+		{
+			break;
+		}
+		gf2_square (odd, even);
+		op = odd;
+		if ((len >>= 1) == 0)
+		{
+			break;
+		}
+	}
+
+	/* The operator is linear, every entry is its lowest bit plus the entry without that bit */
+	for (int k = 0; k < 4; k++)
+	{
+		shift[k][0] = 0;
+		for (n = 1; n < 256; n++)
+		{
+			shift[k][n] = (n & (n - 1)) == 0 ? op[8 * k + __builtin_ctz ((unsigned int) n)]
+				: shift[k][n & (n - 1)] ^ shift[k][n & -n];
+		}
+	}
+}
+
+static uint32_t gf2_times (const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	/* Without a branch, the bits are random */
+	for (; vec != 0; vec >>= 1, mat++)
+	{
+		sum ^= *mat & (0 - (vec & 1));
+	}
+
+	return sum;
+}
+
+static void gf2_square (uint32_t *square, const uint32_t *mat)
+{
+	for (int n = 0; n < 32; n++)
+	{
+		square[n] = gf2_times (mat, mat[n]);
+	}
+}
+#endif
+
+static void select_crc (void)
+{
+	const char *force = getenv ("MYCOMPRESS_SIMD");
+
+#ifdef HAVE_X86_CRC
+	{
+		unsigned int eax, ebx, ecx, edx, xcr0 = 0;
+		int avx512 = force == NULL || strcmp (force, "avx512") == 0;
+
+		if ((force == NULL || strcmp (force, "scalar") != 0) && __get_cpuid (1, &eax, &ebx, &ecx, &edx) != 0
+			&& (ecx & bit_SSE4_2) != 0)
+		{
+			/* The OS has to save the AVX-512 registers too, ask XGETBV */
+			if ((ecx & bit_OSXSAVE) != 0)
+			{
+				__asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+			}
+			avx512 = avx512 && (ecx & bit_PCLMUL) != 0 && (xcr0 & 0xe6) == 0xe6
+				&& __get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) != 0
+				&& (ebx & bit_AVX512F) != 0 && (ecx & bit_VPCLMULQDQ) != 0;
+
+			/* Only the tables of the chosen version are built, folding never gets to the three parts */
+			if (avx512)
+			{
+				build_fold (fold_2048, 2048);
+				build_fold (fold_512, 512);
+				build_fold (fold_384, 384);
+				build_fold (fold_256, 256);
+				build_fold (fold_128, 128);
+				crc_update = crc_update_vpclmul;
+			}
+			else
+			{
+				build_shift (long_shift, LONG_LEN);
+				build_shift (short_shift, SHORT_LEN);
+				crc_update = crc_update_sse42;
+			}
+			return;
+		}
+	}
+#else
+	(void) force;
+#endif
+
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		uint32_t crc = n;
+
+		for (int k = 0; k < 8; k++)
+		{
+			crc = (crc & 1) != 0 ? (crc >> 1) ^ POLY : crc >> 1;
+		}
+		table[0][n] = crc;
+	}
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		for (int k = 1; k < 8; k++)
+		{
+			table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+		}
+	}
+
+	crc_update = crc_update_table;
+}
@@ -0,0 +1,27 @@
+/**
+ * @file crc32c.h
+ * @author Constantin Schieber, e1228774
+ * @brief CRC-32C (Castagnoli) of the blocks of the binary format, see comp_format.h
+ * @details On x86 CPUs with AVX-512 and VPCLMULQDQ the input is folded with carry-less multiplications, with SSE4.2
+ * the crc32 instruction computes three interleaved CRCs at once, everywhere else a slicing-by-8 table does it. The
+ * variant is chosen once per process, the environment variable MYCOMPRESS_SIMD can force a lower one like it does
+ * for the run length kernel.
+ * @date 17.10.2026
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Continues a CRC-32C with more chars
+ * @param crc The CRC of the chars before, 0 for the first chars
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @return The CRC of all chars so far
+ */
+uint32_t crc32c (uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,672 @@
+/**
+ * @file huff.c
+ * @author Constantin Schieber, e1228774
+ * @brief Canonical Huffman coder of the COMP_MODE_HUFF blocks, see huff.h
+ * @details The code lengths come from the in-place algorithm of Moffat and Katajainen over the char counts. Codes
+ * longer than COMP_HUFF_MAX_BITS are shortened afterwards by moving leaves down the tree until the Kraft sum fits
+ * again, the most frequent chars keep the shortest codes.
+ *
+ * The bit streams are filled from the lowest bit upwards, so the canonical codes are stored bit reversed. The encoder
+ * adds four codes (at most 44 bits) to its bit buffer and stores all complete bytes with one unaligned 64 bit write.
+ * The decoder refills its bit buffer to at least 56 bits with one unaligned 64 bit read and decodes four chars.
+ * Every table lookup depends on the previous one of its stream, so the decoder works on all COMP_HUFF_STREAMS streams
+ * in turn to keep several lookups in flight.
+ * @date 17.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "clones.h"
+#include "comp_format.h"
+#include "huff.h"
+
+/* === Constants === */
+
+#define HUFF_TABLE_SIZE (1 << COMP_HUFF_MAX_BITS)
+#define HUFF_TABLE_MASK (HUFF_TABLE_SIZE - 1)
+
+/* Code lengths and the sizes of all streams but the last one */
+#define HUFF_HEADER_LEN (COMP_HUFF_TABLE_LEN + 4 * (COMP_HUFF_STREAMS - 1))
+
+/* Code length of the table entries that are no code, more than a full bit buffer */
+#define HUFF_INVALID (63u)
+
+/* === Structures === */
+
+/* Read position in one bit stream */
+struct s_reader
+{
+	const unsigned char *p;
+	size_t pos;
+	size_t avail;
+	uint64_t bits;
+	unsigned int n;		/*< Valid bits in bits, wraps around after an invalid code */
+};
+
+/* === Prototypes === */
+
+/**
+ * @brief Counts how often every char value occurs
+ * @details Multiversioned, see clones.h.
+ * @param src A reference to the chars
+ * @param len The amount of chars
+ * @param count Set to the count of every char value
+ */
+static void count_chars (const unsigned char *src, size_t len, uint32_t *count);
+
+/**
+ * @brief Codes chars into one bit stream
+ * @details Multiversioned, see clones.h.
+ * @param dst A reference to the output buffer
+ * @param limit Nothing may be written at or beyond dst + limit + HUFF_SLACK
+ * @param src A reference to the chars
+ * @param len The amount of chars
+ * @param lengths The code length of every char value
+ * @param codes The bit reversed code of every char value
+ * @return The amount of chars written, (size_t) -1 if they don't fit
+ */
+static size_t encode_stream (unsigned char *dst, size_t limit, const unsigned char *src, size_t len,
+	const unsigned char *lengths, const uint16_t *codes);
+
+/**
+ * @brief Refills a bit stream and decodes four chars, 8 chars of the stream have to be left
+ * @param r A reference to the reader
+ * @param table The decoding table
+ * @param dst A reference to the output
+ */
+static void decode4 (struct s_reader *r, const uint16_t *table, unsigned char *dst);
+
+/**
+ * @brief Decodes chars from a bit stream one by one, up to its end
+ * @param r A reference to the reader
+ * @param table The decoding table
+ * @param dst A reference to the output
+ * @param len The amount of chars
+ * @return 0 on success, -1 if the stream is corrupt
+ */
+static int decode_tail (struct s_reader *r, const uint16_t *table, unsigned char *dst, size_t len);
+
+/**
+ * @brief Computes code lengths of at most COMP_HUFF_MAX_BITS bits for the chars that occur
+ * @param count The amount of every char value
+ * @param lengths Set to the code length of every char value, 0 for the ones that don't occur
+ */
+static void build_lengths (const uint32_t *count, unsigned char *lengths);
+
+/**
+ * @brief Computes the code lengths of a minimum redundancy code in place
+ * @param a The weights in ascending order, set to the code lengths
+ * @param n The amount of weights, at least 2
+ */
+static void minimum_redundancy (uint32_t *a, int n);
+
+/**
+ * @brief Assigns the canonical codes to the code lengths
+ * @param lengths The code length of every char value
+ * @param codes Set to the bit reversed code of every char value
+ */
+static void build_codes (const unsigned char *lengths, uint16_t *codes);
+
+/**
+ * @brief Compares two unsigned 64 bit integers for qsort(3)
+ * @param a A reference to the first integer
+ * @param b A reference to the second integer
+ * @return Less than, equal to or greater than zero like strcmp
+ */
+static int compare_keys (const void *a, const void *b);
+
+/**
+ * @brief Stores 4 chars in little endian
+ * @param p A reference to the destination
+ * @param v The value
+ */
+static void put32 (unsigned char *p, uint32_t v);
+
+/**
+ * @brief Loads 4 chars in little endian
+ * @param p A reference to the source
+ * @return The value
+ */
+static uint32_t get32 (const unsigned char *p);
+
+/**
+ * @brief Stores 8 chars in little endian, unaligned
+ * @param p A reference to the destination
+ * @param v The value
+ */
+static void put64 (unsigned char *p, uint64_t v);
+
+/**
+ * @brief Loads 8 chars in little endian, unaligned
+ * @param p A reference to the source
+ * @return The value
+ */
+static uint64_t get64 (const unsigned char *p);
+
+/* === Interface === */
+
+size_t huff_encode (unsigned char *dst, size_t cap, const unsigned char *src, size_t len)
+{
+	uint32_t count[256];
+	unsigned char lengths[256];
+	uint16_t codes[256];
+	size_t i, k, out = HUFF_HEADER_LEN, limit, part = (len + COMP_HUFF_STREAMS - 1) / COMP_HUFF_STREAMS;
+
+	if (cap < HUFF_HEADER_LEN + HUFF_SLACK || len > UINT32_MAX)
+	{
+		return 0;
+	}
+	limit = cap - HUFF_SLACK;
+
+	(void) count_chars (src, len, count);
+	(void) build_lengths (count, lengths);
+	(void) build_codes (lengths, codes);
+
+	for (i = 0; i < COMP_HUFF_TABLE_LEN; i++)
+	{
+		dst[i] = (unsigned char) (lengths[2 * i] | lengths[2 * i + 1] << 4);
+	}
+
+	/* Every stream but the last one gets part chars, the sizes of the first ones go in front of the streams */
+	for (k = 0; k < COMP_HUFF_STREAMS; k++)
+	{
+		size_t first = k * part < len ? k * part : len;
+		size_t count = k + 1 < COMP_HUFF_STREAMS ? (part < len - first ? part : len - first) : len - first;
+		size_t size = encode_stream (dst + out, limit - out, src + first, count, lengths, codes);
+
+		if (size == (size_t) -1)
+		{
+			return 0;
+		}
+		if (k + 1 < COMP_HUFF_STREAMS)
+		{
+			(void) put32 (dst + COMP_HUFF_TABLE_LEN + 4 * k, (uint32_t) size);
+		}
+		out += size;
+	}
+
+	return out;
+}
+
+
+int huff_decode (unsigned char *dst, size_t len, const unsigned char *src, size_t src_len)
+{
+	uint16_t table[HUFF_TABLE_SIZE];
+	unsigned char lengths[256];
+	uint16_t codes[256];
+	struct s_reader r[COMP_HUFF_STREAMS];
+	size_t first[COMP_HUFF_STREAMS], end[COMP_HUFF_STREAMS];
+	const unsigned char *p;
+	uint32_t kraft = 0;
+	unsigned int n;
+	size_t i, k, avail, part = (len + COMP_HUFF_STREAMS - 1) / COMP_HUFF_STREAMS;
+
+	if (src_len < HUFF_HEADER_LEN)
+	{
+		return -1;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		lengths[i] = (unsigned char) (src[i / 2] >> (4 * (i % 2)) & 0x0f);
+		if (lengths[i] > COMP_HUFF_MAX_BITS)
+		{
+			return -1;
+		}
+		if (lengths[i] > 0)
+		{
+			kraft += HUFF_TABLE_SIZE >> lengths[i];
+		}
+	}
+	if (kraft > HUFF_TABLE_SIZE)
+	{
+		return -1;
+	}
+	(void) build_codes (lengths, codes);
+
+	/* Every entry holds the char in the low byte and the code length above it. Bits that are no code get a length
+	 * of HUFF_INVALID, which makes the bit count wrap around, so one check after four codes finds them.
+	 */
+	for (i = 0; i < HUFF_TABLE_SIZE; i++)
+	{
+		table[i] = HUFF_INVALID << 8;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		size_t j;
+
+		if (lengths[i] == 0)
+		{
+			continue;
+		}
+		for (j = codes[i]; j < HUFF_TABLE_SIZE; j += (size_t) 1 << lengths[i])
+		{
+			table[j] = (uint16_t) (i | (unsigned int) lengths[i] << 8);
+		}
+	}
+
+	/* Split the input into the streams and the output into their parts */
+	p = src + HUFF_HEADER_LEN;
+	avail = src_len - HUFF_HEADER_LEN;
+	for (k = 0; k < COMP_HUFF_STREAMS; k++)
+	{
+		size_t size = k + 1 < COMP_HUFF_STREAMS ? get32 (src + COMP_HUFF_TABLE_LEN + 4 * k) : avail;
+
+		if (size > avail)
+		{
+			return -1;
+		}
+		r[k].p = p;
+		r[k].pos = 0;
+		r[k].avail = size;
+		r[k].bits = 0;
+		r[k].n = 0;
+		p += size;
+		avail -= size;
+
+		first[k] = k * part < len ? k * part : len;
+		end[k] = k + 1 < COMP_HUFF_STREAMS ? (part < len - first[k] ? first[k] + part : len) : len;
+	}
+
+	/* All streams in turn as long as every one of them has four chars and 8 chars of input left */
+	for (;;)
+	{
+		for (k = 0; k < COMP_HUFF_STREAMS; k++)
+		{
+			if (end[k] - first[k] < 4 || r[k].avail - r[k].pos < 8)
+			{
+				break;
+			}
+		}
+		if (k < COMP_HUFF_STREAMS)
+		{
+			break;
+		}
+
+		/* Valid bit counts stay below 64, so an invalid code shows up in their or */
+		n = 0;
+		for (k = 0; k < COMP_HUFF_STREAMS; k++)
+		{
+			(void) decode4 (&r[k], table, dst + first[k]);
+			first[k] += 4;
+			n |= r[k].n;
+		}
+		if (n >= 64)
+		{
+			return -1;
+		}
+	}
+
+	for (k = 0; k < COMP_HUFF_STREAMS; k++)
+	{
+		if (decode_tail (&r[k], table, dst + first[k], end[k] - first[k]) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+HOT_CLONES
+static void count_chars (const unsigned char *src, size_t len, uint32_t *count)
+{
+	uint32_t counts[4][256];
+	size_t i;
+
+	/* Four histograms don't wait for each other when neighbouring chars are equal */
+	(void) memset (counts, 0, sizeof(counts));
+	for (i = 0; i + 4 <= len; i += 4)
+	{
+		counts[0][src[i]]++;
+		counts[1][src[i + 1]]++;
+		counts[2][src[i + 2]]++;
+		counts[3][src[i + 3]]++;
+	}
+	for (; i < len; i++)
+	{
+		counts[0][src[i]]++;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		count[i] = counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+	}
+}
+
+
+HOT_CLONES
+static size_t encode_stream (unsigned char *dst, size_t limit, const unsigned char *src, size_t len,
+	const unsigned char *lengths, const uint16_t *codes)
+{
+	uint64_t bits = 0;
+	unsigned int n = 0;
+	size_t i, out = 0;
+
+	for (i = 0; i + 4 <= len; i += 4)
+	{
+		if (out > limit)
+		{
+			return (size_t) -1;
+		}
+		bits |= (uint64_t) codes[src[i]] << n;
+		n += lengths[src[i]];
+		bits |= (uint64_t) codes[src[i + 1]] << n;
+		n += lengths[src[i + 1]];
+		bits |= (uint64_t) codes[src[i + 2]] << n;
+		n += lengths[src[i + 2]];
+		bits |= (uint64_t) codes[src[i + 3]] << n;
+		n += lengths[src[i + 3]];
+
+		/* Store everything, keep the incomplete byte */
+		(void) put64 (dst + out, bits);
+		out += n >> 3;
+		bits >>= n & ~7u;
+		n &= 7;
+	}
+	for (; i < len; i++)
+	{
+		if (out > limit)
+		{
+			return (size_t) -1;
+		}
+		bits |= (uint64_t) codes[src[i]] << n;
+		n += lengths[src[i]];
+		(void) put64 (dst + out, bits);
+		out += n >> 3;
+		bits >>= n & ~7u;
+		n &= 7;
+	}
+
+	if (n > 0)
+	{
+		if (out > limit)
+		{
+			return (size_t) -1;
+		}
+		dst[out++] = (unsigned char) bits;
+	}
+
+	return out;
+}
+
+
+static void decode4 (struct s_reader *r, const uint16_t *table, unsigned char *dst)
+{
+	uint64_t bits = r->bits | get64 (r->p + r->pos) << r->n;
+	unsigned int e0, e1, e2, e3;
+
+	r->pos += (63 - r->n) >> 3;
+
+	e0 = table[bits & HUFF_TABLE_MASK];
+	bits >>= e0 >> 8;
+	e1 = table[bits & HUFF_TABLE_MASK];
+	bits >>= e1 >> 8;
+	e2 = table[bits & HUFF_TABLE_MASK];
+	bits >>= e2 >> 8;
+	e3 = table[bits & HUFF_TABLE_MASK];
+	bits >>= e3 >> 8;
+
+	r->bits = bits;
+	r->n = (r->n | 56) - ((e0 >> 8) + (e1 >> 8) + (e2 >> 8) + (e3 >> 8));
+
+	dst[0] = (unsigned char) e0;
+	dst[1] = (unsigned char) e1;
+	dst[2] = (unsigned char) e2;
+	dst[3] = (unsigned char) e3;
+}
+
+
+static int decode_tail (struct s_reader *r, const uint16_t *table, unsigned char *dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned int e, l;
+
+		while (r->n <= 56 && r->pos < r->avail)
+		{
+			r->bits |= (uint64_t) r->p[r->pos++] << r->n;
+			r->n += 8;
+		}
+		e = table[r->bits & HUFF_TABLE_MASK];
+		l = e >> 8;
+		if (l > COMP_HUFF_MAX_BITS || l > r->n)
+		{
+			return -1;
+		}
+		dst[i] = (unsigned char) e;
+		r->bits >>= l;
+		r->n -= l;
+	}
+
+	return 0;
+}
+
+/* === Code construction === */
+
+static void build_lengths (const uint32_t *count, unsigned char *lengths)
+{
+	uint64_t keys[256];
+	uint32_t weights[256];
+	unsigned int num[256];
+	uint32_t total;
+	int n = 0, i, len, k;
+
+	(void) memset (lengths, 0, 256);
+
+	/* Sort the chars that occur by their count, the char value only breaks ties */
+	for (i = 0; i < 256; i++)
+	{
+		if (count[i] > 0)
+		{
+			keys[n++] = (uint64_t) count[i] << 8 | (unsigned int) i;
+		}
+	}
+	if (n == 0)
+	{
+		return;
+	}
+	if (n == 1)
+	{
+		lengths[keys[0] & 0xff] = 1;
+		return;
+	}
+	qsort (keys, (size_t) n, sizeof(keys[0]), compare_keys);
+
+	for (i = 0; i < n; i++)
+	{
+		weights[i] = (uint32_t) (keys[i] >> 8);
+	}
+	(void) minimum_redundancy (weights, n);
+
+	/* Move the leaves that are too deep up to the limit, then split shorter codes until the Kraft sum fits */
+	(void) memset (num, 0, sizeof(num));
+	for (i = 0; i < n; i++)
+	{
+		num[weights[i] < COMP_HUFF_MAX_BITS ? weights[i] : COMP_HUFF_MAX_BITS]++;
+	}
+	total = 0;
+	for (len = 1; len <= COMP_HUFF_MAX_BITS; len++)
+	{
+		total += (uint32_t) num[len] << (COMP_HUFF_MAX_BITS - len);
+	}
+	while (total > HUFF_TABLE_SIZE)
+	{
+		num[COMP_HUFF_MAX_BITS]--;
+		for (len = COMP_HUFF_MAX_BITS - 1; len > 0; len--)
+		{
+			if (num[len] > 0)
+			{
+				num[len]--;
+				num[len + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	/* The most frequent chars get the shortest codes */
+	k = n - 1;
+	for (len = 1; len <= COMP_HUFF_MAX_BITS; len++)
+	{
+		unsigned int j;
+
+		for (j = 0; j < num[len]; j++)
+		{
+			lengths[keys[k--] & 0xff] = (unsigned char) len;
+		}
+	}
+}
+
+
+static void minimum_redundancy (uint32_t *a, int n)
+{
+	int root, leaf, next, avbl, used, dpth;
+
+	/* First pass, left to right: combine the two lightest items, internal nodes point to their parent */
+	a[0] += a[1];
+	root = 0;
+	leaf = 2;
+	for (next = 1; next < n - 1; next++)
+	{
+		if (leaf >= n || a[root] < a[leaf])
+		{
+			a[next] = a[root];
+			a[root++] = (uint32_t) next;
+		}
+		else
+		{
+			a[next] = a[leaf++];
+		}
+
+		if (leaf >= n || (root < next && a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = (uint32_t) next;
+		}
+		else
+		{
+			a[next] += a[leaf++];
+		}
+	}
+
+	/* Second pass, right to left: depths of the internal nodes */
+	a[n - 2] = 0;
+	for (next = n - 3; next >= 0; next--)
+	{
+		a[next] = a[a[next]] + 1;
+	}
+
+	/* Third pass, right to left: depths of the leaves */
+	avbl = 1;
+	used = dpth = 0;
+	root = n - 2;
+	next = n - 1;
+	while (avbl > 0)
+	{
+		while (root >= 0 && (int) a[root] == dpth)
+		{
+			used++;
+			root--;
+		}
+		while (avbl > used)
+		{
+			a[next--] = (uint32_t) dpth;
+			avbl--;
+		}
+		avbl = 2 * used;
+		dpth++;
+		used = 0;
+	}
+}
+
+
+static void build_codes (const unsigned char *lengths, uint16_t *codes)
+{
+	unsigned int num[COMP_HUFF_MAX_BITS + 1], next[COMP_HUFF_MAX_BITS + 1], code = 0;
+	int i, len;
+
+	(void) memset (num, 0, sizeof(num));
+	for (i = 0; i < 256; i++)
+	{
+		num[lengths[i]]++;
+	}
+	num[0] = 0;
+	for (len = 1; len <= COMP_HUFF_MAX_BITS; len++)
+	{
+		code = (code + num[len - 1]) << 1;
+		next[len] = code;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		unsigned int c, r = 0;
+
+		if (lengths[i] == 0)
+		{
+			codes[i] = 0;
+			continue;
+		}
+		c = next[lengths[i]]++;
+		for (len = 0; len < lengths[i]; len++)
+		{
+			r = r << 1 | (c >> len & 1);
+		}
+		codes[i] = (uint16_t) r;
+	}
+}
+
+
+static int compare_keys (const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+
+static void put32 (unsigned char *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		p[i] = (unsigned char) (v >> (8 * i));
+	}
+}
+
+
+static uint32_t get32 (const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+static void put64 (unsigned char *p, uint64_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	(void) memcpy (p, &v, 8);
+#else
+	for (int i = 0; i < 8; i++)
+	{
+		p[i] = (unsigned char) (v >> (8 * i));
+	}
+#endif
+}
+
+
+static uint64_t get64 (const unsigned char *p)
+{
+	uint64_t v = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	(void) memcpy (&v, p, 8);
+#else
+	for (int i = 7; i >= 0; i--)
+	{
+		v = v << 8 | p[i];
+	}
+#endif
+
+	return v;
+}
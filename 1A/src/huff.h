@@ -0,0 +1,40 @@
+/**
+ * @file huff.h
+ * @author Constantin Schieber, e1228774
+ * @brief Canonical Huffman coder of the COMP_MODE_HUFF blocks, see comp_format.h
+ * @details Both directions work on 64 bit bit buffers. The encoder looks up code and length of every char in a table,
+ * the decoder looks up char and length with the next COMP_HUFF_MAX_BITS bits of the stream in a table of
+ * 2^COMP_HUFF_MAX_BITS entries.
+ * @date 17.10.2026
+ */
+
+#ifndef HUFF_H
+#define HUFF_H
+
+#include <stddef.h>
+
+/* Chars that huff_encode() may write beyond the end of its result, but not beyond cap */
+#define HUFF_SLACK (8)
+
+/**
+ * @brief Codes chars with a Huffman code built for them
+ * @details Writes the code lengths table and the bit stream, the token length is up to the caller.
+ * @param dst A reference to the output buffer
+ * @param cap The size of the output buffer, the coding is given up if it does not fit
+ * @param src A reference to the chars
+ * @param len The amount of chars, at most 2^32 - 1
+ * @return The amount of chars written to dst, 0 if they don't fit into cap
+ */
+size_t huff_encode (unsigned char *dst, size_t cap, const unsigned char *src, size_t len);
+
+/**
+ * @brief Decodes the code lengths table and the bit stream written by huff_encode()
+ * @param dst A reference to the output buffer
+ * @param len The amount of chars to decode
+ * @param src A reference to the code lengths table
+ * @param src_len The amount of chars of the table and the bit stream
+ * @return 0 on success, -1 if the input is corrupt
+ */
+int huff_decode (unsigned char *dst, size_t len, const unsigned char *src, size_t src_len);
+
+#endif
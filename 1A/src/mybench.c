@@ -0,0 +1,500 @@
+/**
+ * @file mybench.c
+ * @author Constantin Schieber, e1228774
+ * @brief Measures the throughput of compressors like mycompress on generated corpora
+ * @details Generates four corpora of the same size (random bytes, long runs, English text and sparse binary) from a
+ * fixed seed, so every run of the benchmark sees the same input. Existing corpora of the right size are reused. Every
+ * compressor that is given as argument is run on every corpus, the fastest of several runs counts. The results are
+ * written to stdout as CSV: throughput in MB/s, compression ratio (compressed size / original size) and peak RSS of
+ * the compressor in KiB.
+ *
+ * A compressor is one argument with the command line of the compressor, the name of the corpus is appended to it.
+ * Leading words of the form NAME=VALUE are set in the environment of the compressor, e.g.
+ * "MYCOMPRESS_SIMD=scalar ./mycompress -f 2". The compressor has to write its output to the name of the corpus with
+ * .comp appended, like mycompress does.
+ * @date 17.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* === Constants === */
+
+/* Default size of every corpus in MiB */
+#define DEFAULT_SIZE (64)
+
+/* Default amount of runs per compressor and corpus */
+#define DEFAULT_RUNS (3)
+
+/* Most words of one compressor command line */
+#define MAX_WORDS (32)
+
+/* Size of the buffer a corpus is generated in */
+#define GEN_BUF_SIZE (1 << 20)
+
+/* === Structures === */
+
+/* A corpus and the function that fills it, the generator gets the state of the random number generator */
+struct s_corpus
+{
+	const char *name;
+	void (*generate) (unsigned char *buf, size_t len, uint64_t *seed);
+};
+
+/* === Global Variables === */
+
+/* Name of the program */
+static const char *pgm_name = "mybench";
+
+/* Words of the text corpus, the first ones are the most frequent */
+static const char *const words[] =
+{
+	"the", "of", "and", "to", "a", "in", "is", "it", "you", "that", "he", "was", "for", "on", "are", "with", "as",
+	"his", "they", "be", "at", "one", "have", "this", "from", "or", "had", "by", "word", "but", "what", "some", "we",
+	"can", "out", "other", "were", "all", "there", "when", "up", "use", "your", "how", "said", "an", "each", "she",
+	"which", "do", "their", "time", "if", "will", "way", "about", "many", "then", "them", "write", "would", "like",
+	"so", "these", "her", "long", "make", "thing", "see", "him", "two", "has", "look", "more", "day", "could", "go",
+	"come", "did", "number", "sound", "no", "most", "people", "my", "over", "know", "water", "than", "call", "first"
+};
+
+/* === Prototypes === */
+
+/**
+ * @brief Terminates the program with a message on stderr
+ * @param exitcode The exit code
+ * @param fmt The format string of the message
+ */
+static void bail_out (int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Prints the Synopsis for calling the program and terminates
+ */
+static void usage (void);
+
+/**
+ * @brief Returns the next number of a xorshift64* random number generator
+ * @param seed A reference to the state of the generator
+ * @return The random number
+ */
+static uint64_t next_random (uint64_t *seed);
+
+/**
+ * @brief Fills a buffer with random bytes
+ * @param buf A reference to the buffer
+ * @param len The size of the buffer
+ * @param seed A reference to the state of the random number generator
+ */
+static void generate_random (unsigned char *buf, size_t len, uint64_t *seed);
+
+/**
+ * @brief Fills a buffer with runs of letters, most of them short, some of them up to 64 KiB long
+ * @param buf A reference to the buffer
+ * @param len The size of the buffer
+ * @param seed A reference to the state of the random number generator
+ */
+static void generate_runs (unsigned char *buf, size_t len, uint64_t *seed);
+
+/**
+ * @brief Fills a buffer with English words in lines of about 70 chars
+ * @param buf A reference to the buffer
+ * @param len The size of the buffer
+ * @param seed A reference to the state of the random number generator
+ */
+static void generate_text (unsigned char *buf, size_t len, uint64_t *seed);
+
+/**
+ * @brief Fills a buffer with zeros and one random byte in about 64 bytes
+ * @param buf A reference to the buffer
+ * @param len The size of the buffer
+ * @param seed A reference to the state of the random number generator
+ */
+static void generate_sparse (unsigned char *buf, size_t len, uint64_t *seed);
+
+/**
+ * @brief Writes a corpus unless a file of the same name and size exists already
+ * @param corpus A reference to the corpus
+ * @param path The name of the file
+ * @param size The size of the corpus in chars
+ */
+static void write_corpus (const struct s_corpus *corpus, const char *path, off_t size);
+
+/**
+ * @brief Runs a compressor on a corpus and waits for it
+ * @param command The command line of the compressor
+ * @param path The name of the corpus
+ * @param max_rss Set to the peak RSS of the compressor in KiB
+ * @return The wall clock time of the run in seconds
+ */
+static double run_compressor (const char *command, const char *path, long *max_rss);
+
+/* === Corpora === */
+
+static const struct s_corpus corpora[] =
+{
+	{ "random.bin", generate_random },
+	{ "runs.bin", generate_runs },
+	{ "text.txt", generate_text },
+	{ "sparse.bin", generate_sparse }
+};
+
+#define CORPUS_COUNT (sizeof(corpora) / sizeof(corpora[0]))
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE in case of an error
+ */
+int main (int argc, char **argv)
+{
+	const char *dir = "bench_data";
+	long size = DEFAULT_SIZE, runs = DEFAULT_RUNS, n;
+	char *end;
+	int opt;
+
+	pgm_name = argv[0];
+
+	while ((opt = getopt (argc, argv, "d:n:s:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				dir = optarg;
+				break;
+			case 'n':
+			case 's':
+				errno = 0;
+				n = strtol (optarg, &end, 10);
+				if (errno != 0 || *end != '\0' || n < 1 || n > 4096)
+				{
+					usage ();
+				}
+				if (opt == 'n')
+				{
+					runs = n;
+				}
+				else
+				{
+					size = n;
+				}
+				break;
+			default:
+				usage ();
+		}
+	}
+
+	if (optind == argc)
+	{
+		usage ();
+	}
+
+	if (mkdir (dir, 0755) == -1 && errno != EEXIST)
+	{
+		bail_out (EXIT_FAILURE, "Error while creating %s", dir);
+	}
+
+	(void) printf ("compressor,corpus,bytes,seconds,mb_per_s,ratio,max_rss_kb\n");
+	(void) fflush (stdout);
+
+	for (size_t c = 0; c < CORPUS_COUNT; c++)
+	{
+		char path[4096], comp_path[4096 + 5];
+		off_t bytes = (off_t) size << 20;
+		struct stat st;
+
+		if (snprintf (path, sizeof(path), "%s/%s", dir, corpora[c].name) >= (int) sizeof(path))
+		{
+			bail_out (EXIT_FAILURE, "Name of the directory too long");
+		}
+		(void) snprintf (comp_path, sizeof(comp_path), "%s.comp", path);
+		(void) write_corpus (&corpora[c], path, bytes);
+
+		for (int i = optind; i < argc; i++)
+		{
+			double best = 0.0;
+			long max_rss = 0;
+
+			for (long r = 0; r < runs; r++)
+			{
+				long rss;
+				double seconds = run_compressor (argv[i], path, &rss);
+
+				if (r == 0 || seconds < best)
+				{
+					best = seconds;
+				}
+				if (rss > max_rss)
+				{
+					max_rss = rss;
+				}
+			}
+
+			if (stat (comp_path, &st) == -1)
+			{
+				bail_out (EXIT_FAILURE, "\"%s\" did not write %s", argv[i], comp_path);
+			}
+
+			(void) printf ("\"%s\",%s,%lld,%.6f,%.1f,%.4f,%ld\n", argv[i], corpora[c].name, (long long) bytes, best,
+				best > 0 ? (double) bytes / best / 1e6 : 0.0, (double) st.st_size / (double) bytes, max_rss);
+			(void) fflush (stdout);
+
+			(void) unlink (comp_path);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+static void bail_out (int exitcode, const char *fmt, ...)
+{
+	va_list ap;
+
+	(void) fprintf (stderr, "%s: ", pgm_name);
+	if (fmt != NULL)
+	{
+		va_start (ap, fmt);
+		(void) vfprintf (stderr, fmt, ap);
+		va_end (ap);
+	}
+	if (errno != 0)
+	{
+		(void) fprintf (stderr, ": %s", strerror (errno));
+	}
+	(void) fprintf (stderr, "\n");
+
+	exit (exitcode);
+}
+
+
+static void usage (void)
+{
+	(void) fprintf (stderr, "Usage: %s [-d dir] [-n runs] [-s MiB] compressor ...\n", pgm_name);
+	exit (EXIT_FAILURE);
+}
+
+
+static uint64_t next_random (uint64_t *seed)
+{
+	*seed ^= *seed >> 12;
+	*seed ^= *seed << 25;
+	*seed ^= *seed >> 27;
+
+	return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+
+static void generate_random (unsigned char *buf, size_t len, uint64_t *seed)
+{
+	size_t i = 0;
+
+	while (i < len)
+	{
+		uint64_t r = next_random (seed);
+
+		for (int k = 0; k < 8 && i < len; k++)
+		{
+			buf[i++] = (unsigned char) (r >> (8 * k));
+		}
+	}
+}
+
+
+static void generate_runs (unsigned char *buf, size_t len, uint64_t *seed)
+{
+	static uint64_t run;
+	static unsigned char c;
+	size_t i = 0;
+
+	/* A run may continue in the next buffer */
+	while (i < len)
+	{
+		if (run == 0)
+		{
+			uint64_t r = next_random (seed);
+
+			c = (unsigned char) ('a' + r % 26);
+			run = (r >> 8) % 16 == 0 ? 1 + (r >> 16) % 65536 : 1 + (r >> 16) % 64;
+		}
+		for (; run > 0 && i < len; run--)
+		{
+			buf[i++] = c;
+		}
+	}
+}
+
+
+static void generate_text (unsigned char *buf, size_t len, uint64_t *seed)
+{
+	static const char *pending = "";
+	static size_t column;
+	const size_t word_count = sizeof(words) / sizeof(words[0]);
+	size_t i = 0;
+
+	/* A word may continue in the next buffer */
+	while (i < len)
+	{
+		if (*pending == '\0')
+		{
+			uint64_t r = next_random (seed);
+
+			/* The product of two uniform indices favours the first words */
+			size_t w = (size_t) ((r % word_count) * ((r >> 16) % word_count) / word_count);
+
+			if (column > 70)
+			{
+				buf[i++] = '\n';
+				column = 0;
+			}
+			else if (column > 0)
+			{
+				buf[i++] = ' ';
+				column++;
+			}
+			pending = words[w];
+			continue;
+		}
+		buf[i++] = (unsigned char) *pending++;
+		column++;
+	}
+}
+
+
+static void generate_sparse (unsigned char *buf, size_t len, uint64_t *seed)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		uint64_t r = next_random (seed);
+
+		buf[i] = r % 64 == 0 ? (unsigned char) (1 + (r >> 8) % 255) : 0;
+	}
+}
+
+
+static void write_corpus (const struct s_corpus *corpus, const char *path, off_t size)
+{
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	unsigned char *buf;
+	struct stat st;
+	FILE *f;
+
+	if (stat (path, &st) == 0 && st.st_size == size)
+	{
+		return;
+	}
+
+	if ((buf = malloc (GEN_BUF_SIZE)) == NULL)
+	{
+		bail_out (EXIT_FAILURE, "Error while allocating memory");
+	}
+	if ((f = fopen (path, "w")) == NULL)
+	{
+		bail_out (EXIT_FAILURE, "Error while opening %s", path);
+	}
+
+	while (size > 0)
+	{
+		size_t len = size < GEN_BUF_SIZE ? (size_t) size : GEN_BUF_SIZE;
+
+		(void) corpus->generate (buf, len, &seed);
+		if (fwrite (buf, 1, len, f) != len)
+		{
+			bail_out (EXIT_FAILURE, "Error while writing %s", path);
+		}
+		size -= (off_t) len;
+	}
+
+	if (fclose (f) == EOF)
+	{
+		bail_out (EXIT_FAILURE, "Error while writing %s", path);
+	}
+	free (buf);
+}
+
+
+static double run_compressor (const char *command, const char *path, long *max_rss)
+{
+	struct timespec start, stop;
+	struct rusage usage;
+	char line[4096], *argv[MAX_WORDS + 2], *word;
+	int argc = 0, status, null_fd;
+	pid_t pid;
+
+	if (strlen (command) >= sizeof(line))
+	{
+		errno = 0;
+		bail_out (EXIT_FAILURE, "Command line too long: %s", command);
+	}
+	(void) strcpy (line, command);
+
+	/* Split the command line at blanks, NAME=VALUE words in front of the program go to the environment */
+	for (word = strtok (line, " \t"); word != NULL; word = strtok (NULL, " \t"))
+	{
+		if (argc == MAX_WORDS)
+		{
+			errno = 0;
+			bail_out (EXIT_FAILURE, "Too many words: %s", command);
+		}
+		argv[argc++] = word;
+	}
+	argv[argc++] = (char *) path;
+	argv[argc] = NULL;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+
+	if ((pid = fork ()) == -1)
+	{
+		bail_out (EXIT_FAILURE, "Error while forking");
+	}
+	if (pid == 0)
+	{
+		char **args = argv;
+
+		while (*args != NULL && args[1] != NULL && strchr (*args, '=') != NULL && **args != '=')
+		{
+			(void) putenv (*args++);
+		}
+
+		/* The summary of the compressor is not part of the results */
+		if ((null_fd = open ("/dev/null", O_WRONLY)) == -1 || dup2 (null_fd, STDOUT_FILENO) == -1)
+		{
+			bail_out (EXIT_FAILURE, "Error while opening /dev/null");
+		}
+		(void) close (null_fd);
+
+		(void) execvp (args[0], args);
+		bail_out (127, "Error while executing %s", args[0]);
+	}
+
+	while (wait4 (pid, &status, 0, &usage) == -1)
+	{
+		if (errno != EINTR)
+		{
+			bail_out (EXIT_FAILURE, "Error while waiting for %s", command);
+		}
+	}
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &stop);
+
+	if (!WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+	{
+		errno = 0;
+		bail_out (EXIT_FAILURE, "\"%s\" failed on %s", command, path);
+	}
+
+	*max_rss = usage.ru_maxrss;
+
+	return (double) (stop.tv_sec - start.tv_sec) + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
@@ -10,19 +10,207 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include "comp_format.h"
+#include "rle.h"
+#include "ringio.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 /* === Constants === */
 
 const int SIGN_MAX = 9;
 
+/* Size of the blocks that are read from a streamed input */
+#define READ_BUF_SIZE (1 << 20)
+
+/* Upper limit for -j */
+#define MAX_THREADS (256)
+
+/* Seconds between two lines of --stats */
+#define STATS_INTERVAL (1)
+
+/* Files of -r that are larger are compressed in slices of this many chars by every worker that is idle, a multiple
+ * of COMP_BLOCK_SIZE */
+#define SLICE_SIZE (16 << 20)
+
+/* Kinds of the tasks of -r */
+#define TASK_DIR (0)
+#define TASK_FILE (1)
+#define TASK_SLICE (2)
+
 
 /* === Global Variables === */
 
 /* Name of the program */
 char* pgm_name;
 
-/* Input and output stream */
-FILE *in_stream, *out_stream;
+/* One entry per input, in the order of argv */
+struct s_io_information *jobs;
+int job_count;
+
+/* Output format, 1 is the legacy char / decimal count format, 2 the binary format of comp_format.h. Set with -f */
+int format = 1;
+
+/* Amount of threads that compress one input, set with -j */
+int threads = 1;
+
+/* Distance between two entries of the block index in chars, 0 if no index is written. Set with -i */
+uint64_t index_interval;
+
+/* Entropy coding stage of the binary format, 0 none, 1 Huffman. Set with -z */
+int level;
+
+/* All inputs are compressed into this archive instead of one .comp file each, set with -a */
+char *archive_name;
+
+/* Amount of inputs that are compressed at the same time, set with -p. Without -p it is 1, for -r the amount of
+ * online CPUs
+ */
+int workers;
+
+/* Print the progress of every input to stderr, set with --stats */
+int stats;
+
+/* Index of the next job a worker takes from the schedule, guarded by job_lock */
+int next_job;
+
+/* Jobs sorted by descending input size */
+int *schedule;
+
+/* Index of the next job whose summary has to be printed, guarded by job_lock */
+int next_summary;
+
+/* A job of compress_files() failed, the workers take no further jobs. Guarded by job_lock */
+int failed;
+
+pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Directories are compressed with every file below them, set with -r */
+int recursive;
+
+/* The workers of -r, each one has a deque of tasks */
+struct s_worker *pool;
+
+/* Tasks of -r in the deques and tasks in the deques or running, both atomic. queued only changes under the lock of
+ * the deque the task is pushed to or taken from, so it never counts a task that is not there.
+ */
+size_t queued;
+size_t pending;
+
+/* A task of -r failed, the workers take no further tasks. Atomic, set under pool_lock */
+int pool_failed;
+
+/* Workers of -r that wait on pool_cond, atomic. pool_lock is only taken to wait and to wake them up, the tasks
+ * themselves only take the lock of their deque
+ */
+int idle;
+
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/* Files of -r that are open, guarded by files_lock. compress_tree() closes them and removes their outputs if a task
+ * failed
+ */
+struct s_io_information *open_files;
+
+pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* === Structures === */
+
+/* Everything that belongs to the compression of one input */
+struct s_io_information
+{
+	char *in_name;
+	char *out_name;
+	FILE *in_stream;
+	FILE *out_stream;
+	unsigned char *in_map;	/*< Mapping of the input file, NULL if the input is streamed */
+	size_t in_map_len;
+	off_t in_size;		/*< Size of the input as far as known before opening it, used for scheduling */
+	uint64_t in_ccount;
+	uint64_t out_ccount;
+	uint64_t out_offset;	/*< Offset of the compressed input in the archive */
+	int done;		/*< The summary can be printed, guarded by job_lock */
+	struct s_io_information *prev;	/*< Neighbours in open_files, guarded by files_lock */
+	struct s_io_information *next;
+	struct s_sliced_file *sliced;	/*< The slices of a file of -r, NULL if it is compressed as a whole */
+};
+
+/* Output file of a compression */
+struct s_sink
+{
+	struct ringio *io;
+	int error;		/*< errno of the failed write */
+};
+
+/* Compressed output of one slice of a file of -r */
+struct s_slice
+{
+	char *buf;
+	size_t start;		/*< The stream header in front of the output, it is not written */
+	size_t len;		/*< The end of the output, without the end of the stream if it is not the last slice */
+	int done;		/*< guarded by the lock of the file */
+	int first_x;		/*< Legacy format: the first run, it is not part of the output */
+	size_t first_count;
+	int last_x;		/*< Legacy format: the last run, it is not part of the output. 0 chars if the first run */
+	size_t last_count;	/*< is the whole slice */
+};
+
+/* A file of -r that is compressed in slices, the slices are written in order by the worker that finishes the next
+ * one
+ */
+struct s_sliced_file
+{
+	struct s_io_information *job;
+	struct s_slice *slices;
+	size_t slice_count;
+	size_t next_write;	/*< The slice that is written next, guarded by lock */
+	int writing;		/*< A worker writes slices, guarded by lock */
+	int open_x;		/*< Legacy format: the run the next slice may continue, only used by the writing worker */
+	uint64_t open_count;
+	pthread_mutex_t lock;
+};
+
+/* A task of -r */
+struct s_task
+{
+	int kind;			/*< TASK_DIR, TASK_FILE or TASK_SLICE */
+	char *path;			/*< TASK_DIR and TASK_FILE: the path, owned by the task */
+	struct s_sliced_file *file;	/*< TASK_SLICE: the file */
+	size_t slice;			/*< TASK_SLICE: the index of the slice */
+};
+
+/* Tasks of one worker, the worker takes the newest one from the bottom and the others steal the oldest one from the
+ * top
+ */
+struct s_deque
+{
+	struct s_task *tasks;
+	size_t size;
+	size_t top;
+	size_t bottom;
+	pthread_mutex_t lock;
+};
+
+/* A worker of -r */
+struct s_worker
+{
+	int id;
+	pthread_t tid;
+	struct s_deque deque;
+	struct rle_context *ctx;	/*< Context of the slices, created with the first one */
+	struct s_slice *out;		/*< The slice the output of ctx goes to */
+};
 
 /* === Prototypes === */
 
@@ -38,20 +226,286 @@ void usage (void);
 
 /**
  *	* @brief Reads the stream, compresses while reading and writes to the output stream
- *	 * @details Reads the given input stream char by char, counts the occourences of the same char and writes the amount of
- *	  * occurences to the output stream when the next char is different from the previous.
- *	   * @param in_ccount A reference to the int that counts the amount of chars of the original file
- *	    * @param in_ccount A reference to the int that counts the amount of chars of the compressed file
+ *	 * @details Reading and writing go through a pipeline (ringio.h), the next blocks are read and the previous
+ *	  * output is written while a block is compressed. Only the buffers of the pipeline, the buffers of the library
+ *	   * and the block index are allocated, so an endless stdin is compressed in constant memory (apart from the
+ *	    * index).
+ *	     * @param job A reference to the job with the opened streams
+ *	      * @return 0 on success, -1 on an error that has been printed
+ *	       */
+int compress (struct s_io_information*);
+
+/**
+ *	* @brief Compresses all jobs into the archive archive_name
+ *	 * @details The inputs are compressed one after the other with the same context and pipeline, every one is a
+ *	  * stream of its own in the archive. The file table behind them is built from the jobs (comp_format.h). The
+ *	   * archive is synced once when it is complete.
+ *	    */
+void compress_archive (void);
+
+/**
+ *	* @brief Creates a compression with the options of the command line
+ *	 * @param ctx Set to the new context
+ *	  * @param sink The callback that receives the output
+ *	   * @param opaque Passed to every call of sink
+ *	    * @return 0 on success, -1 on an error that has been printed
+ *	     */
+int init_compression (struct rle_context**, rle_sink, void*);
+
+/**
+ *	* @brief Returns the amount of chars handed to the library at once
+ *	 * @return The size of an input buffer
+ *	  */
+size_t input_size (void);
+
+/**
+ *	* @brief Compresses the input of a job into one stream of a context
+ *	 * @details Reads the input in blocks of input_size() and hands them to the context, which writes its output to
+ *	  * the sink with write_output(). The stream is finished afterwards. The amount of chars of the original and of
+ *	   * the compressed stream are stored in in_ccount and out_ccount of the job.
+ *	    * @param job A reference to the job with the opened input
+ *	     * @param ctx A reference to the context, no stream must have been started on it
+ *	      * @param sink A reference to the sink of the context
+ *	       * @return 0 on success, -1 on an error that has been printed
+ *	        */
+int compress_stream (struct s_io_information*, struct rle_context*, struct s_sink*);
+
+/**
+ *	* @brief Prints the amount of chars read and written and the throughput of a job to stderr
+ *	 * @param job A reference to the job
+ *	  * @param in_ccount The amount of chars read so far
+ *	   * @param out_ccount The amount of chars written so far
+ *	    * @param start The time when the compression of the job started
+ *	     */
+void print_stats (const struct s_io_information*, uint64_t, uint64_t, const struct timespec*);
+
+/**
+ *	* @brief Opens, compresses and closes the input of a job
+ *	 * @param job A reference to the job
+ *	  * @return 0 on success, -1 on an error that has been printed, the streams are left to close_stream()
+ *	   */
+int compress_job (struct s_io_information*);
+
+/**
+ *	* @brief Compresses all jobs with a pool of workers
+ *	 * @details The workers take the jobs from the largest to the smallest input, the summaries are still printed in
+ *	  * the order of argv. Once a job failed the workers take no further jobs, all of them are joined before this
+ *	   * returns.
+ *	    * @return 0 on success, -1 if a job failed
+ *	     */
+int compress_files (void);
+
+/**
+ *	* @brief Thread routine of the workers of compress_files()
+ *	 * @param arg unused
+ *	  * @return NULL
+ *	   */
+void *file_worker (void*);
+
+/**
+ *	* @brief Compares two job indices by the input size of the jobs, larger inputs first
+ *	 * @param a A reference to the first index
+ *	  * @param b A reference to the second index
+ *	   * @return Less than, equal to or greater than zero like strcmp
+ *	    */
+int compare_jobs (const void*, const void*);
+
+/**
+ *	* @brief Prints the summaries of all finished jobs that are next in argv order
+ *	 * @details Has to be called with job_lock held.
+ *	  */
+void print_summaries (void);
+
+/**
+ *	* @brief Compresses the files and directory trees of -r with a pool of workers
+ *	 * @details Every worker has a deque of tasks. A directory task pushes a task for every entry, so the trees are
+ *	  * walked by all workers at once. A file task compresses the file, large files without an index are cut into
+ *	   * slice tasks of SLICE_SIZE chars. Workers without tasks steal from the others. The summaries are printed when
+ *	    * the files are done.
+ *	     * @param paths The operands
+ *	      * @param count The amount of operands
+ *	       * @return 0 on success, -1 if a task failed. The workers are joined and the files that were still open are
+ *	        * closed, their incomplete outputs are removed.
+ *	         */
+int compress_tree (char**, int);
+
+/**
+ *	* @brief Thread routine of the workers of compress_tree()
+ *	 * @param arg A reference to the struct s_worker
+ *	  * @return NULL
+ *	   */
+void *tree_worker (void*);
+
+/**
+ *	* @brief Pushes a task onto the bottom of the deque of a worker
+ *	 * @param worker A reference to the worker
+ *	  * @param task A reference to the task, it is copied
+ *	   * @return 0 on success, -1 on an error that has been printed, the task is not pushed then
+ *	    */
+int push_task (struct s_worker*, const struct s_task*);
+
+/**
+ *	* @brief Takes the next task of a worker
+ *	 * @details The newest task of the own deque comes first, then the oldest one of any other deque. Blocks while
+ *	  * every deque is empty but tasks are still running.
+ *	   * @param self A reference to the worker
+ *	    * @param task Set to the task
+ *	     * @return 1 if there is a task, 0 once all tasks are done or one of them failed
+ *	      */
+int take_task (struct s_worker*, struct s_task*);
+
+/**
+ *	* @brief Pushes a task for every directory and regular file in a directory
+ *	 * @details Links are not followed, files that end with .comp are skipped.
+ *	  * @param self A reference to the worker
+ *	   * @param path The path of the directory, it is freed
+ *	    * @return 0 on success, -1 on an error that has been printed
+ *	     */
+int walk_directory (struct s_worker*, char*);
+
+/**
+ *	* @brief Compresses a file of -r or starts its first slice
+ *	 * @param self A reference to the worker
+ *	  * @param path The path of the file, it is freed once the file is done
+ *	   * @return 0 on success, -1 on an error that has been printed
+ *	    */
+int compress_file (struct s_worker*, char*);
+
+/**
+ *	* @brief Compresses one slice of a file of -r
+ *	 * @details The next slice is pushed first, so another worker can steal it. Every slice is compressed as a
+ *	  * complete stream, the header is cut off all slices but the first one and the end of the stream off all slices
+ *	   * but the last one. Runs of the legacy format may cross the border of a slice, its first and last run are
+ *	   * kept out of the stream and joined with the neighbours by write_slices().
+ *	    * @param self A reference to the worker
+ *	     * @param file A reference to the file
+ *	      * @param k The index of the slice
+ *	       * @return 0 on success, -1 on an error that has been printed
+ *	        */
+int compress_slice (struct s_worker*, struct s_sliced_file*, size_t);
+
+/**
+ *	* @brief Marks a slice as done and writes all slices that are done and next in order
+ *	 * @details Only one worker writes at a time, the others leave their slices to it. The file is closed with the
+ *	  * last slice. The legacy format keeps the last run open, it is joined with the first run of the next slice
+ *	  * like compress_parallel() in rle.c joins its chunks.
+ *	   * @param file A reference to the file
+ *	    * @param k The index of the slice
+ *	     * @return 0 on success, -1 on an error that has been printed
+ *	      */
+int write_slices (struct s_sliced_file*, size_t);
+
+/**
+ *	* @brief Prints the summary of a file of -r and releases its job
+ *	 * @param job A reference to the job, in_name and out_name are freed
+ *	  */
+void finish_file (struct s_io_information*);
+
+/**
+ *	* @brief Writes a run of the legacy format to the output of a sliced file
+ *	 * @param file A reference to the file
+ *	  * @param c The char of the run
+ *	   * @param count The length of the run, runs the format can't hold are written as several runs
+ *	    * @return 0 on success, -1 on an error that has been printed
+ *	     */
+int write_run (struct s_sliced_file*, int, uint64_t);
+
+/**
+ *	* @brief Sink of the slices, appends the output to the slice of the worker
+ *	 * @param opaque A reference to the struct s_worker
+ *	  * @param buf A reference to the buffer
+ *	   * @param len The amount of chars
+ *	    * @return 0
+ *	     */
+int collect_output (void*, const char*, size_t);
+
+/**
+ *	* @brief Writes a whole buffer to a file descriptor
+ *	 * @param fd The file descriptor
+ *	  * @param buf A reference to the buffer
+ *	   * @param len The amount of chars
+ *	    * @return 0 on success, -1 on an error that has been printed
  *	     */
-void compress (int*, int*);
+int write_fully (int, const char*, size_t);
+
+/**
+ *	* @brief Tells what a path is to -r
+ *	 * @param path The path
+ *	  * @param entry The directory entry of the path, NULL for an operand. Operands that are links are followed, other
+ *	   * links are not.
+ *	    * @return TASK_DIR, TASK_FILE or -1 if it is neither a directory nor a regular file
+ *	     */
+int path_kind (const char*, const struct dirent*);
+
+/**
+ *	* @brief Joins a directory and a name to a path
+ *	 * @param dir The directory
+ *	  * @param name The name
+ *	   * @return The allocated path, NULL on an error that has been printed
+ *	    */
+char *join_path (const char*, const char*);
+
+/**
+ *	* @brief Maps a regular input file into memory
+ *	 * @details Empty files and everything that is not a regular file stay unmapped and get streamed.
+ *	  * @param job A reference to the job with the opened input stream
+ *	   */
+void map_stream (struct s_io_information*);
+
+/**
+ *	* @brief Releases the mapping and closes the streams of a job
+ *	 * @param job A reference to the job
+ *	  * @return 0 on success, -1 on an error that has been printed
+ *	   */
+int close_stream (struct s_io_information*);
+
+/**
+ *	* @brief Sink of the compression, hands a whole buffer to the pipeline of the output file
+ *	 * @param opaque A reference to the struct s_sink of the output file
+ *	   * @param buf A reference to the buffer
+ *	    * @param len The amount of chars to write
+ *	     * @return 0 on success, -1 on an error, the errno is kept in the struct s_sink
+ *	      */
+int write_output (void*, const char*, size_t);
+
+/**
+ *	* @brief Prints why a compression failed
+ *	 * @param err The return code of the library
+ *	  * @param sink A reference to the sink of the compression, only needed for RLE_ERROR_SINK
+ *	   * @return -1
+ *	    */
+int compress_failed (int, const struct s_sink*);
 
 /**
  *	* @brief Opens the input and output stream
- *	 * @details
- *	  * @param in_name A reference to the name of the input stream
- *	   * @param out_name A reference to the name of the output stream
+ *	 * @details The name of the output stream is the name of the input stream with .comp appended, it is stored in
+ *	  * the job.
+ *	   * @param job A reference to the job, in_name has to be set
+ *	    * @return 0 on success, -1 on an error that has been printed
+ *	     */
+int open_stream (struct s_io_information*);
+
+/**
+ *	* @brief Opens and maps the input stream
+ *	 * @param job A reference to the job, in_name has to be set
+ *	  * @return 0 on success, -1 on an error that has been printed
+ *	   */
+int open_input (struct s_io_information*);
+
+/**
+ *	* @brief Encodes an unsigned LEB128 varint
+ *	 * @param dst A reference to the output buffer, at least COMP_VARINT_MAX chars have to be free
+ *	  * @param v The value
+ *	   * @return The amount of chars written to dst
  *	    */
-void open_stream (char* , char* );
+size_t put_varint (unsigned char*, uint64_t);
+
+/**
+ *	* @brief Encodes an unsigned 64 bit integer in little endian
+ *	 * @param dst A reference to the output buffer, at least 8 chars have to be free
+ *	  * @param v The value
+ *	   */
+void put_u64 (unsigned char*, uint64_t);
 
 /*In Out CcIn CcOut*/
 
@@ -63,7 +517,7 @@ void open_stream (char* , char* );
  *	    * @param in_ccount The amount of chars in the original file
  *	     * @param out_ccount The amount of chars in the compressed file
  *	      */
-void output_summary (char*, char*, int, int);
+void output_summary (char*, char*, uint64_t, uint64_t);
 
 
 
@@ -78,33 +532,141 @@ int main(int argc, char** argv)
 	/* Define a subroutine where the program jumps to if it exits gracefully */
 	(void) atexit (cleanup);
 
-	/* Input / Output Character Count */
-	int in_ccount, out_ccount;	
-	
 	/* Save the name of the program */
 	pgm_name = argv[0];
-	
 
-	/* Program is called with arguments */
-	if (argc > 1)
-	{	
-		for (int i = 1; i < argc; i++)
-		{
-			char* out_name = malloc(sizeof(char)* (strlen(argv[i])+5));	//Allocate memory for the name of the output string
-			(void) open_stream (argv[i], out_name);
-			(void) compress (&in_ccount, &out_ccount);
-			(void) output_summary (argv[i], out_name, in_ccount, out_ccount);
-			free(out_name);
-		}
-	 }
-	 else
-	 {
-		 char* out_name = malloc(sizeof(char)* (strlen("stdin.txt")+5));	//Allocate memory for the name of the output string
-		 (void) open_stream ("stdin", out_name );
-		 (void) compress (&in_ccount, &out_ccount);
-		 (void) output_summary ("stdin", out_name, in_ccount, out_ccount);
-		 free(out_name);
-	 }
+	int opt;
+	char *end;
+	long n;
+
+	static const struct option long_options[] =
+	{
+		{ "stats", no_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long (argc, argv, "a:f:i:j:p:rz:", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				stats = 1;
+				break;
+			case 'r':
+				recursive = 1;
+				break;
+			case 'a':
+				archive_name = optarg;
+				break;
+			case 'f':
+				if (strcmp (optarg, "1") != 0 && strcmp (optarg, "2") != 0)
+				{
+					usage ();
+				}
+				format = optarg[0] - '0';
+				break;
+			case 'i':
+				errno = 0;
+				n = strtol (optarg, &end, 10);
+				if (errno != 0 || *end != '\0' || n < 1 || n > 1024 * 1024)
+				{
+					usage ();
+				}
+				index_interval = (uint64_t) n * COMP_BLOCK_SIZE;
+				break;
+			case 'z':
+				if (strcmp (optarg, "0") != 0 && strcmp (optarg, "1") != 0)
+				{
+					usage ();
+				}
+				level = optarg[0] - '0';
+				break;
+			case 'j':
+			case 'p':
+				errno = 0;
+				n = strtol (optarg, &end, 10);
+				if (errno != 0 || *end != '\0' || n < 1 || n > MAX_THREADS)
+				{
+					usage ();
+				}
+				if (opt == 'j')
+				{
+					threads = (int) n;
+				}
+				else
+				{
+					workers = (int) n;
+				}
+				break;
+			default:
+				usage ();
+		}
+	}
+
+	/* The index and the entropy coding are only part of the binary format */
+	if ((index_interval != 0 || level != 0) && format != 2)
+	{
+		usage ();
+	}
+
+	/* A single large file of -r is cut into slices for all CPUs, so -r keeps them all busy by default */
+	if (workers == 0)
+	{
+		n = recursive ? sysconf (_SC_NPROCESSORS_ONLN) : 1;
+		workers = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : (int) n;
+	}
+
+	/* The members of an archive are named by their files and compressed one after the other */
+	if (archive_name != NULL && (optind == argc || workers > 1))
+	{
+		usage ();
+	}
+
+	/* The trees of -r are walked while their files are compressed, there is no job per operand */
+	if (recursive)
+	{
+		if (optind == argc || archive_name != NULL)
+		{
+			usage ();
+		}
+		exit (compress_tree (argv + optind, argc - optind) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	/* Program is called with arguments, otherwise stdin is the only input */
+	job_count = optind < argc ? argc - optind : 1;
+	if ((jobs = calloc ((size_t) job_count, sizeof(*jobs))) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+	for (int i = 0; i < job_count; i++)
+	{
+		jobs[i].in_name = optind < argc ? argv[optind + i] : "stdin";
+	}
+
+	if (archive_name != NULL)
+	{
+		(void) compress_archive ();
+	}
+	else if (workers > 1 && job_count > 1)
+	{
+		/* The streams of a failed job are closed by cleanup() once no worker uses them any more */
+		if (compress_files () != 0)
+		{
+			exit (EXIT_FAILURE);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < job_count; i++)
+		{
+			if (compress_job (&jobs[i]) != 0)
+			{
+				exit (EXIT_FAILURE);
+			}
+			(void) output_summary (jobs[i].in_name, jobs[i].out_name, jobs[i].in_ccount, jobs[i].out_ccount);
+		}
+	}
 
 	 exit (EXIT_SUCCESS);
 }
@@ -112,167 +674,1221 @@ int main(int argc, char** argv)
 
 void cleanup (void)
 {
-	if (in_stream != NULL) 
-	{
-		fclose (in_stream);
-	}
-	if (out_stream != NULL)
+	for (int i = 0; i < job_count; i++)
 	{
-		fclose (out_stream);
+		(void) close_stream (&jobs[i]);
 	}
 }
 
 
 void usage (void)
 {
-	(void) fprintf(stderr, "Usage: %s [file1] [file2] ...\n", pgm_name);
+	(void) fprintf(stderr, "Usage: %s [-a archive] [-f format] [-i MiB] [-j threads] [-p workers] [-r] [-z level] [--stats] [file1] [file2] ...\n", pgm_name);
 	exit (EXIT_FAILURE);
 }
 
 
-void open_stream (char* in_name, char* out_name)
+int open_stream (struct s_io_information* job)
 {
-	/* If we have a stdin as input we need to handle it in another way */		
-	if (strcmp(in_name, "stdin") != 0) 
-	{
-		if ((in_stream = fopen(in_name, "r")) == NULL)
-		{
-			usage();	//The only case where the user could benefit from a usage() call
-			exit (EXIT_FAILURE);
-		}
+	char *in_name = job->in_name, *out_name;
 
-	}
-	else
+	if (open_input (job) != 0)
 	{
-		in_stream = stdin;
+		return -1;
 	}
 
+	//Allocate memory for the name of the output string
+	if ((out_name = job->out_name = malloc (sizeof(char) * (strlen (in_name) + 6))) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		return -1;
+	}
 
 	/* Rename the output file from xxx.txt to xxx.txt.comp */
 	if ((strcpy (out_name, in_name)) == NULL)
 	{
 		(void) fprintf(stderr, "%s: Error while copying strings: %s\n", pgm_name, strerror (errno));
-		exit (EXIT_FAILURE);
+		return -1;
 	}
 
 	if ((strcat (out_name, ".comp")) == NULL)
 	{
 		(void) fprintf(stderr, "%s: Error while concatenating strings: %s\n", pgm_name, strerror (errno));
-		exit (EXIT_FAILURE);
+		return -1;
 	}
 
 	
 	/* Output file is always the same */
-	if ((out_stream = fopen(out_name, "w")) == NULL)
+	if ((job->out_stream = fopen(out_name, "w")) == NULL)
 	{
 		(void) fprintf(stderr, "%s: Error while opening stream: %s\n", pgm_name, strerror (errno));
 		//Couldn't open stream
-		exit (EXIT_FAILURE);
+		return -1;
 	}
+
+	return 0;
 }
 
 
-void compress (int* in_ccount, int* out_ccount)
+int open_input (struct s_io_information* job)
 {
-	int x, prev_x=NULL, count_x=1;
-	int in_length = 0, out_length = 0;
-
-	/* Read the input stream char by char and count how often the char occours consecutive. Always save the previous char.
-	 * If the chars are not equal write the current sign and its number of occurrences to the output stream
-	 */
-	while ((x = fgetc (in_stream)) != EOF)
+	/* If we have a stdin as input we need to handle it in another way */		
+	if (strcmp(job->in_name, "stdin") != 0) 
 	{
-		if (in_length > 0)
+		/* No usage() here, the input may be opened by a worker while the others still compress */
+		if ((job->in_stream = fopen(job->in_name, "r")) == NULL)
 		{
-			if(prev_x == x)
-			{
-				count_x++;
-			}
-			else
-			{
-				if ((fputc(prev_x, out_stream)) == EOF)
-				{
-					(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (errno));
-					
-					//Could not write to file
-					exit (EXIT_FAILURE);
-				}
+			(void) fprintf(stderr, "%s: Error while opening stream %s: %s\n", pgm_name, job->in_name, strerror (errno));
+			return -1;
+		}
 
-				if ((fprintf(out_stream, "%d", count_x)) == EOF)
-				{
-					
-					(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (errno));
+		(void) map_stream (job);
+	}
+	else
+	{
+		job->in_stream = stdin;
+	}
 
-					//Could not write to file
-					exit (EXIT_FAILURE);
-				}
-				
-				prev_x = x;
-				count_x = 1;
-				out_length+=2;
-			}
-		}
-		else
-		{
-			prev_x = x;
-		}
+	return 0;
+}
 
-		in_length++;
-				
-		/* The maximal amount of signs in one line is defined as the constant LINE_MAX, but since we can assume that no
-		 * line contains more than LINE_MAX signs (which could be 0 too) no checks are done.
-		 */
-		
+
+void map_stream (struct s_io_information* job)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat (fileno (job->in_stream), &st) == -1 || !S_ISREG (st.st_mode) || st.st_size <= 0
+		|| (unsigned long long) st.st_size > (size_t) -1)
+	{
+		return;
 	}
-	
-	*in_ccount = in_length;
-	*out_ccount = out_length;
 
-	if ((fputc(prev_x, out_stream)) == EOF)
+	/* If the file can't be mapped we just stream it */
+	map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno (job->in_stream), 0);
+	if (map == MAP_FAILED)
 	{
-		(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (errno));
-		
-		//Could not write to file
-		exit (EXIT_FAILURE);
+		return;
 	}
-	
-	if ((fprintf(out_stream, "%d", count_x)) == EOF)
+
+	/* The hints are only hints, their return values don't matter */
+	(void) madvise (map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	(void) madvise (map, (size_t) st.st_size, MADV_HUGEPAGE);
+#endif
+
+	job->in_map = map;
+	job->in_map_len = (size_t) st.st_size;
+}
+
+
+int close_stream (struct s_io_information* job)
+{
+	if (job->in_map != NULL)
 	{
-		(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (errno));
-	
-		//Could not write to file
-		exit (EXIT_FAILURE);
+		(void) munmap (job->in_map, job->in_map_len);
+		job->in_map = NULL;
+	}
+	if (job->in_stream != NULL)
+	{
+		if (job->in_stream != stdin)
+		{
+			(void) fclose (job->in_stream);
+		}
+		job->in_stream = NULL;
+	}
+	if (job->out_stream != NULL)
+	{
+		FILE *out = job->out_stream;
+
+		job->out_stream = NULL;
+		if (fclose (out) == EOF)
+		{
+			(void) fprintf(stderr, "%s: Error while closing stream: %s\n", pgm_name, strerror (errno));
+			return -1;
+		}
 	}
 
+	return 0;
 }
 
 
-void output_summary (char* in_name, char* out_name, int in_ccount, int out_ccount)
+int compress_job (struct s_io_information* job)
 {
-	int offset = strlen( out_name ) + 2; /*< Because of ': ' + 2*/
-	
-	char *in = (char *) malloc(sizeof(char)*offset);
-	if (in == NULL) 
+	if (open_stream (job) != 0 || compress (job) != 0)
 	{
-		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		return -1;
 	}
-	
-	//We don't need to check the return value of memcpy since it only returns a pointer to dest, same goes for strcat
-	(void) memcpy(in , in_name, offset);	
-	(void) strcat( in, ": " );
 
-	char *out = (char *) malloc(sizeof(char)*offset);
-	if (out == NULL)
+	return close_stream (job);
+}
+
+
+int compress_files (void)
+{
+	pthread_t tids[MAX_THREADS];
+	struct stat st;
+	int i, err;
+
+	if ((schedule = malloc (sizeof(int) * (size_t) job_count)) == NULL)
 	{
 		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+
+	/* Check every input before the first one is compressed, the sizes decide the order */
+	for (i = 0; i < job_count; i++)
+	{
+		jobs[i].in_size = 0;
+		if (strcmp (jobs[i].in_name, "stdin") != 0)
+		{
+			if (stat (jobs[i].in_name, &st) == -1)
+			{
+				usage ();
+			}
+			jobs[i].in_size = st.st_size;
+		}
+		schedule[i] = i;
 	}
-	(void) memcpy(out , out_name, offset);
-	(void) strcat( out, ": " );
+	qsort (schedule, (size_t) job_count, sizeof(int), compare_jobs);
 
-	(void) fprintf(stdout, "%-*s%-d\n%-*s%-d\n", offset, in, in_ccount,
-			offset, out,
-			out_ccount);
+	for (i = 0; i < workers && i < job_count; i++)
+	{
+		if ((err = pthread_create (&tids[i], NULL, file_worker, NULL)) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while creating thread: %s\n", pgm_name, strerror (err));
+			exit (EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < workers && i < job_count; i++)
+	{
+		if ((err = pthread_join (tids[i], NULL)) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while joining thread: %s\n", pgm_name, strerror (err));
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	free (schedule);
+
+	return failed ? -1 : 0;
+}
+
+
+void *file_worker (void* arg)
+{
+	(void) arg;
+
+	for (;;)
+	{
+		struct s_io_information *job;
+		int err;
+
+		(void) pthread_mutex_lock (&job_lock);
+		if (failed || next_job == job_count)
+		{
+			(void) pthread_mutex_unlock (&job_lock);
+			break;
+		}
+		job = &jobs[schedule[next_job++]];
+		(void) pthread_mutex_unlock (&job_lock);
+
+		/* A worker must not exit, the others still read their inputs. The error is left to the main thread */
+		err = compress_job (job);
+
+		(void) pthread_mutex_lock (&job_lock);
+		if (err != 0)
+		{
+			failed = 1;
+		}
+		else
+		{
+			job->done = 1;
+			(void) print_summaries ();
+		}
+		(void) pthread_mutex_unlock (&job_lock);
+	}
+
+	return NULL;
+}
+
+
+int compare_jobs (const void* a, const void* b)
+{
+	off_t sa = jobs[*(const int *) a].in_size, sb = jobs[*(const int *) b].in_size;
+
+	if (sa != sb)
+	{
+		return sa > sb ? -1 : 1;
+	}
+
+	/* Equal sizes keep the order of argv */
+	return *(const int *) a - *(const int *) b;
+}
+
+
+void print_summaries (void)
+{
+	while (next_summary < job_count && jobs[next_summary].done)
+	{
+		struct s_io_information *job = &jobs[next_summary++];
+
+		(void) output_summary (job->in_name, job->out_name, job->in_ccount, job->out_ccount);
+	}
+	(void) fflush (stdout);
+}
+
+
+int compress_tree (char** paths, int count)
+{
+	struct s_task task;
+	int i, err;
+
+	if ((pool = calloc ((size_t) workers, sizeof(*pool))) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < workers; i++)
+	{
+		pool[i].id = i;
+		(void) pthread_mutex_init (&pool[i].deque.lock, NULL);
+	}
+
+	/* The operands are dealt out to the deques, the workers balance them by stealing */
+	for (i = 0; i < count; i++)
+	{
+		errno = 0;
+		if ((task.kind = path_kind (paths[i], NULL)) == -1)
+		{
+			/* errno is left alone if the operand exists but is neither a directory nor a regular file */
+			(void) fprintf(stderr, "%s: %s: %s\n", pgm_name, paths[i], errno != 0 ? strerror (errno)
+				: "Not a directory or regular file");
+			exit (EXIT_FAILURE);
+		}
+		if ((task.path = strdup (paths[i])) == NULL)
+		{
+			(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+			exit (EXIT_FAILURE);
+		}
+		task.file = NULL;
+		task.slice = 0;
+		if (push_task (&pool[i % workers], &task) != 0)
+		{
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < workers; i++)
+	{
+		if ((err = pthread_create (&pool[i].tid, NULL, tree_worker, &pool[i])) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while creating thread: %s\n", pgm_name, strerror (err));
+			exit (EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < workers; i++)
+	{
+		if ((err = pthread_join (pool[i].tid, NULL)) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while joining thread: %s\n", pgm_name, strerror (err));
+			exit (EXIT_FAILURE);
+		}
+	}
+
+	/* Not before all workers are joined, the others steal from every deque until they stop */
+	for (i = 0; i < workers; i++)
+	{
+		struct s_deque *d = &pool[i].deque;
+
+		/* Only left behind by a failed task */
+		for (; d->top < d->bottom; d->top++)
+		{
+			free (d->tasks[d->top].path);
+		}
+		free (d->tasks);
+		(void) pthread_mutex_destroy (&d->lock);
+	}
+
+	free (pool);
+	pool = NULL;
+
+	/* No worker is left that could use the files that are still open, their outputs are incomplete */
+	while (open_files != NULL)
+	{
+		struct s_io_information *job = open_files;
+		int created = job->out_stream != NULL;
+
+		open_files = job->next;
+		(void) close_stream (job);
+		if (created && remove (job->out_name) == -1)
+		{
+			(void) fprintf(stderr, "%s: Error while removing %s: %s\n", pgm_name, job->out_name, strerror (errno));
+		}
+
+		/* The slices that were compressed but not written yet */
+		if (job->sliced != NULL)
+		{
+			for (size_t k = 0; k < job->sliced->slice_count; k++)
+			{
+				free (job->sliced->slices[k].buf);
+			}
+			(void) pthread_mutex_destroy (&job->sliced->lock);
+			free (job->sliced->slices);
+			free (job->sliced);
+		}
+		free (job->in_name);
+		free (job->out_name);
+		free (job);
+	}
+
+	return pool_failed ? -1 : 0;
+}
+
+
+void *tree_worker (void* arg)
+{
+	struct s_worker *self = arg;
+	struct s_task task;
+	int err;
+
+	while (take_task (self, &task))
+	{
+		/* A worker must not exit, the others still use their files. The error is left to the main thread */
+		if (task.kind == TASK_DIR)
+		{
+			err = walk_directory (self, task.path);
+		}
+		else if (task.kind == TASK_FILE)
+		{
+			err = compress_file (self, task.path);
+		}
+		else
+		{
+			err = compress_slice (self, task.file, task.slice);
+		}
+
+		/* Waiting workers check both under pool_lock, so the wake up can't slip in before they wait */
+		if (__atomic_sub_fetch (&pending, 1, __ATOMIC_SEQ_CST) == 0 || err != 0)
+		{
+			(void) pthread_mutex_lock (&pool_lock);
+			if (err != 0)
+			{
+				__atomic_store_n (&pool_failed, 1, __ATOMIC_SEQ_CST);
+			}
+			(void) pthread_cond_broadcast (&pool_cond);
+			(void) pthread_mutex_unlock (&pool_lock);
+		}
+	}
+
+	(void) rle_free (self->ctx);
+
+	return NULL;
+}
+
+
+int push_task (struct s_worker* worker, const struct s_task* task)
+{
+	struct s_deque *d = &worker->deque;
+
+	(void) pthread_mutex_lock (&d->lock);
+
+	if (d->bottom == d->size)
+	{
+		/* Stolen tasks leave room at the top, the deque only grows if that is not enough */
+		if (d->top > 0)
+		{
+			(void) memmove (d->tasks, d->tasks + d->top, (d->bottom - d->top) * sizeof(*d->tasks));
+			d->bottom -= d->top;
+			d->top = 0;
+		}
+		if (d->bottom == d->size)
+		{
+			size_t size = d->size == 0 ? 64 : 2 * d->size;
+			struct s_task *tasks;
+
+			if ((tasks = realloc (d->tasks, size * sizeof(*d->tasks))) == NULL)
+			{
+				(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+				(void) pthread_mutex_unlock (&d->lock);
+				return -1;
+			}
+			d->tasks = tasks;
+			d->size = size;
+		}
+	}
+	d->tasks[d->bottom++] = *task;
+
+	/* Counted before anyone can take it, pending must not drop to 0 in between */
+	(void) __atomic_add_fetch (&pending, 1, __ATOMIC_SEQ_CST);
+	(void) __atomic_add_fetch (&queued, 1, __ATOMIC_SEQ_CST);
+	(void) pthread_mutex_unlock (&d->lock);
+
+	/* A worker that is about to wait counts itself first and checks queued again, it sees the task or is woken */
+	if (__atomic_load_n (&idle, __ATOMIC_SEQ_CST) > 0)
+	{
+		(void) pthread_mutex_lock (&pool_lock);
+		(void) pthread_cond_signal (&pool_cond);
+		(void) pthread_mutex_unlock (&pool_lock);
+	}
+
+	return 0;
+}
+
+
+int take_task (struct s_worker* self, struct s_task* task)
+{
+	int found = 0, done;
+
+	for (;;)
+	{
+		/* The own deque first, then the others in turn */
+		for (int i = 0; i < workers && !found; i++)
+		{
+			struct s_deque *d = &pool[(self->id + i) % workers].deque;
+
+			(void) pthread_mutex_lock (&d->lock);
+			if (d->top < d->bottom)
+			{
+				*task = i == 0 ? d->tasks[--d->bottom] : d->tasks[d->top++];
+				(void) __atomic_sub_fetch (&queued, 1, __ATOMIC_SEQ_CST);
+				found = 1;
+			}
+			(void) pthread_mutex_unlock (&d->lock);
+		}
+
+		if (found && !__atomic_load_n (&pool_failed, __ATOMIC_SEQ_CST))
+		{
+			return 1;
+		}
+
+		/* Idle, nothing to steal */
+		(void) pthread_mutex_lock (&pool_lock);
+		(void) __atomic_add_fetch (&idle, 1, __ATOMIC_SEQ_CST);
+		while (!__atomic_load_n (&pool_failed, __ATOMIC_SEQ_CST) && __atomic_load_n (&queued, __ATOMIC_SEQ_CST) == 0
+			&& __atomic_load_n (&pending, __ATOMIC_SEQ_CST) > 0)
+		{
+			(void) pthread_cond_wait (&pool_cond, &pool_lock);
+		}
+		(void) __atomic_sub_fetch (&idle, 1, __ATOMIC_SEQ_CST);
+		done = __atomic_load_n (&pending, __ATOMIC_SEQ_CST) == 0 || __atomic_load_n (&pool_failed, __ATOMIC_SEQ_CST);
+		(void) pthread_mutex_unlock (&pool_lock);
+
+		if (done)
+		{
+			/* The task is dropped, compress_tree() frees the ones that are still queued */
+			if (found)
+			{
+				free (task->path);
+			}
+			return 0;
+		}
+	}
+}
+
+
+int walk_directory (struct s_worker* self, char* path)
+{
+	struct dirent *entry;
+	struct s_task task;
+	DIR *dir;
+	int ret = 0;
+
+	if ((dir = opendir (path)) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while opening directory %s: %s\n", pgm_name, path, strerror (errno));
+		free (path);
+		return -1;
+	}
+
+	task.file = NULL;
+	task.slice = 0;
+	for (errno = 0; (entry = readdir (dir)) != NULL; errno = 0)
+	{
+		size_t len = strlen (entry->d_name);
+
+		/* The outputs of earlier runs and of this one are not compressed again */
+		if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0
+			|| (len >= 5 && strcmp (entry->d_name + len - 5, ".comp") == 0))
+		{
+			continue;
+		}
+
+		if ((task.path = join_path (path, entry->d_name)) == NULL)
+		{
+			ret = -1;
+			break;
+		}
+		if ((task.kind = path_kind (task.path, entry)) == -1)
+		{
+			free (task.path);
+			continue;
+		}
+		if (push_task (self, &task) != 0)
+		{
+			free (task.path);
+			ret = -1;
+			break;
+		}
+	}
+	if (ret == 0 && errno != 0)
+	{
+		(void) fprintf(stderr, "%s: Error while reading directory %s: %s\n", pgm_name, path, strerror (errno));
+		ret = -1;
+	}
+
+	(void) closedir (dir);
+	free (path);
+
+	return ret;
+}
+
+
+int compress_file (struct s_worker* self, char* path)
+{
+	struct s_io_information *job;
+	struct s_sliced_file *file;
+
+	if ((job = calloc (1, sizeof(*job))) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		free (path);
+		return -1;
+	}
+	job->in_name = path;
+
+	/* From here on compress_tree() closes the file if a task fails */
+	(void) pthread_mutex_lock (&files_lock);
+	job->next = open_files;
+	if (open_files != NULL)
+	{
+		open_files->prev = job;
+	}
+	open_files = job;
+	(void) pthread_mutex_unlock (&files_lock);
+
+	if (open_stream (job) != 0)
+	{
+		return -1;
+	}
+
+	/* Streams without an index can be put together from slices, an index would have to point into all of them */
+	if (job->in_map == NULL || job->in_map_len <= SLICE_SIZE || index_interval != 0)
+	{
+		if (compress (job) != 0 || close_stream (job) != 0)
+		{
+			return -1;
+		}
+		(void) finish_file (job);
+		return 0;
+	}
+
+	if ((file = calloc (1, sizeof(*file))) == NULL
+		|| (file->slices = calloc ((job->in_map_len + SLICE_SIZE - 1) / SLICE_SIZE, sizeof(*file->slices))) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		free (file);
+		return -1;
+	}
+	file->job = job;
+	file->slice_count = (job->in_map_len + SLICE_SIZE - 1) / SLICE_SIZE;
+	(void) pthread_mutex_init (&file->lock, NULL);
+	job->sliced = file;
+
+	return compress_slice (self, file, 0);
+}
+
+
+int compress_slice (struct s_worker* self, struct s_sliced_file* file, size_t k)
+{
+	struct s_io_information *job = file->job;
+	struct s_slice *slice = &file->slices[k];
+	size_t offset = k * (size_t) SLICE_SIZE, len = job->in_map_len - offset, size;
+	const unsigned char *in = job->in_map + offset;
+	struct s_task task;
+	int err;
+
+	/* The rest of the file is up for stealing while this slice is compressed */
+	if (k + 1 < file->slice_count)
+	{
+		task.kind = TASK_SLICE;
+		task.path = NULL;
+		task.file = file;
+		task.slice = k + 1;
+		if (push_task (self, &task) != 0)
+		{
+			return -1;
+		}
+	}
+	len = len > SLICE_SIZE ? SLICE_SIZE : len;
+
+	/* Only the runs in between are compressed, the first and the last one may continue in the neighbours */
+	if (format != 2)
+	{
+		size_t first = 1, last = 0;
+
+		while (first < len && in[first] == in[0])
+		{
+			first++;
+		}
+		if (first < len)
+		{
+			/* Stops at the first run at the latest */
+			for (last = 1; in[len - 1 - last] == in[len - 1]; last++)
+			{
+			}
+		}
+		slice->first_x = in[0];
+		slice->first_count = first;
+		slice->last_x = in[len - 1];
+		slice->last_count = last;
+		in += first;
+		len -= first + last;
+	}
+
+	/* Room for the whole stream, collect_output() never has to grow it. A legacy run never takes more than twice its
+	 * length
+	 */
+	size = format == 2 ? COMP_HEADER_LEN + (len + COMP_BLOCK_SIZE - 1) / COMP_BLOCK_SIZE * COMP_BLOCK_BOUND(COMP_BLOCK_SIZE)
+		+ 1 : 2 * len + RLE_RUN_MAX_LEN;
+	if ((slice->buf = malloc (size)) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		return -1;
+	}
+	self->out = slice;
+
+	if (self->ctx == NULL)
+	{
+		if (init_compression (&self->ctx, collect_output, self) != 0)
+		{
+			return -1;
+		}
+	}
+	else if ((err = rle_reset (self->ctx)) != RLE_OK)
+	{
+		return compress_failed (err, NULL);
+	}
+	if ((err = rle_update (self->ctx, in, len)) != RLE_OK || (err = rle_finish (self->ctx)) != RLE_OK)
+	{
+		return compress_failed (err, NULL);
+	}
+
+	/* The blocks of the slices follow each other as if they were one stream */
+	if (format == 2)
+	{
+		slice->start = k > 0 ? COMP_HEADER_LEN : 0;
+		slice->len -= k + 1 < file->slice_count ? 1 : 0;
+	}
+
+	return write_slices (file, k);
+}
+
+
+int write_slices (struct s_sliced_file* file, size_t k)
+{
+	struct s_io_information *job = file->job;
+	int last;
+
+	(void) pthread_mutex_lock (&file->lock);
+	file->slices[k].done = 1;
+	if (file->writing)
+	{
+		(void) pthread_mutex_unlock (&file->lock);
+		return 0;
+	}
+
+	file->writing = 1;
+	while (file->next_write < file->slice_count && file->slices[file->next_write].done)
+	{
+		struct s_slice *slice = &file->slices[file->next_write];
+
+		(void) pthread_mutex_unlock (&file->lock);
+
+		/* writing stays set after an error, no other worker writes behind the gap */
+		if (format != 2)
+		{
+			/* The first run continues the open run or the open run ends before it */
+			if (file->open_count > 0 && file->open_x != slice->first_x)
+			{
+				if (write_run (file, file->open_x, file->open_count) != 0)
+				{
+					return -1;
+				}
+				file->open_count = 0;
+			}
+			file->open_x = slice->first_x;
+			file->open_count += slice->first_count;
+
+			/* The runs in between end the open run, the last one is left open */
+			if (slice->last_count > 0)
+			{
+				if (write_run (file, file->open_x, file->open_count) != 0)
+				{
+					return -1;
+				}
+				file->open_x = slice->last_x;
+				file->open_count = slice->last_count;
+			}
+		}
+		if (write_fully (fileno (job->out_stream), slice->buf + slice->start, slice->len - slice->start) != 0)
+		{
+			return -1;
+		}
+		job->out_ccount += slice->len - slice->start;
+		free (slice->buf);
+		slice->buf = NULL;
+		(void) pthread_mutex_lock (&file->lock);
+
+		file->next_write++;
+	}
+	file->writing = 0;
+	last = file->next_write == file->slice_count;
+	(void) pthread_mutex_unlock (&file->lock);
+
+	if (last)
+	{
+		job->in_ccount = job->in_map_len;
+		if ((file->open_count > 0 && write_run (file, file->open_x, file->open_count) != 0) || close_stream (job) != 0)
+		{
+			return -1;
+		}
+		(void) finish_file (job);
+		(void) pthread_mutex_destroy (&file->lock);
+		free (file->slices);
+		free (file);
+	}
+
+	return 0;
+}
+
+
+void finish_file (struct s_io_information* job)
+{
+	(void) pthread_mutex_lock (&files_lock);
+	if (job->prev != NULL)
+	{
+		job->prev->next = job->next;
+	}
+	else
+	{
+		open_files = job->next;
+	}
+	if (job->next != NULL)
+	{
+		job->next->prev = job->prev;
+	}
+	(void) pthread_mutex_unlock (&files_lock);
+
+	(void) pthread_mutex_lock (&job_lock);
+	(void) output_summary (job->in_name, job->out_name, job->in_ccount, job->out_ccount);
+	(void) fflush (stdout);
+	(void) pthread_mutex_unlock (&job_lock);
+
+	free (job->in_name);
+	free (job->out_name);
+	free (job);
+}
+
+
+int write_run (struct s_sliced_file* file, int c, uint64_t count)
+{
+	char buf[RLE_RUN_MAX_LEN];
+
+	while (count > 0)
+	{
+		uint32_t n = count > RLE_RUN_COUNT_MAX ? RLE_RUN_COUNT_MAX : (uint32_t) count;
+		size_t len = rle_encode_run (buf, c, n);
+
+		if (write_fully (fileno (file->job->out_stream), buf, len) != 0)
+		{
+			return -1;
+		}
+		file->job->out_ccount += len;
+		count -= n;
+	}
+
+	return 0;
+}
+
+
+int collect_output (void* opaque, const char* buf, size_t len)
+{
+	struct s_slice *slice = ((struct s_worker *) opaque)->out;
+
+	(void) memcpy (slice->buf + slice->len, buf, len);
+	slice->len += len;
+
+	return 0;
+}
+
+
+int write_fully (int fd, const char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write (fd, buf, len);
+
+		if (n == -1)
+		{
+			(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (errno));
+			return -1;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+
+int path_kind (const char* path, const struct dirent* entry)
+{
+	struct stat st;
+
+#if defined(_DIRENT_HAVE_D_TYPE) && defined(DT_UNKNOWN)
+	/* Most file systems tell the type of an entry without a stat */
+	if (entry != NULL && entry->d_type != DT_UNKNOWN)
+	{
+		return entry->d_type == DT_DIR ? TASK_DIR : entry->d_type == DT_REG ? TASK_FILE : -1;
+	}
+#endif
+
+	if ((entry == NULL ? stat (path, &st) : lstat (path, &st)) == -1)
+	{
+		return -1;
+	}
+
+	return S_ISDIR (st.st_mode) ? TASK_DIR : S_ISREG (st.st_mode) ? TASK_FILE : -1;
+}
+
+
+char *join_path (const char* dir, const char* name)
+{
+	size_t len = strlen (dir);
+	char *path;
+
+	if ((path = malloc (len + strlen (name) + 2)) == NULL)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (errno));
+		return NULL;
+	}
+	(void) strcpy (path, dir);
+	if (len == 0 || dir[len - 1] != '/')
+	{
+		path[len++] = '/';
+	}
+	(void) strcpy (path + len, name);
+
+	return path;
+}
+
+
+int compress (struct s_io_information* job)
+{
+	struct rle_context *ctx = NULL;
+	struct s_sink sink;
+	int err, ret;
+
+	/* A mapped file is not read at all, only its output goes through the pipeline */
+	if ((err = ringio_init (&sink.io, job->in_map != NULL ? -1 : fileno (job->in_stream), fileno (job->out_stream),
+		input_size ())) != 0)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (err));
+		return -1;
+	}
+	sink.error = 0;
+
+	if ((ret = init_compression (&ctx, write_output, &sink)) == 0 && (ret = compress_stream (job, ctx, &sink)) == 0
+		&& (sink.error = ringio_flush (sink.io)) != 0)
+	{
+		ret = compress_failed (RLE_ERROR_SINK, &sink);
+	}
+
+	/* Also after an error, the pipeline waits for its requests before the streams can be closed */
+	(void) ringio_free (sink.io);
+	(void) rle_free (ctx);
+
+	return ret;
+}
+
+
+void compress_archive (void)
+{
+	unsigned char buf[COMP_MAGIC_LEN + 3 * 8 + COMP_VARINT_MAX];
+	struct rle_context *ctx;
+	struct s_sink sink;
+	uint64_t pos;
+	size_t n;
+	int fd, err;
+
+	if ((fd = open (archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+	{
+		(void) fprintf(stderr, "%s: Error while opening stream: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+	if ((err = ringio_init (&sink.io, -1, fd, input_size ())) != 0)
+	{
+		(void) fprintf(stderr, "%s: Error while allocating memory: %s\n", pgm_name, strerror (err));
+		exit (EXIT_FAILURE);
+	}
+	sink.error = 0;
+	if (init_compression (&ctx, write_output, &sink) != 0)
+	{
+		exit (EXIT_FAILURE);
+	}
+
+	(void) memcpy (buf, COMP_ARCHIVE_MAGIC, COMP_MAGIC_LEN);
+	buf[COMP_MAGIC_LEN] = COMP_ARCHIVE_VERSION;
+	pos = COMP_ARCHIVE_HEADER_LEN;
+	if (write_output (&sink, (char *) buf, COMP_ARCHIVE_HEADER_LEN) != 0)
+	{
+		(void) compress_failed (RLE_ERROR_SINK, &sink);
+		exit (EXIT_FAILURE);
+	}
+
+	/* The members share the context and the pipeline, nothing is allocated or created per input */
+	for (int i = 0; i < job_count; i++)
+	{
+		struct s_io_information *job = &jobs[i];
+
+		if (open_input (job) != 0)
+		{
+			exit (EXIT_FAILURE);
+		}
+		if (job->in_map == NULL && (err = ringio_input (sink.io, fileno (job->in_stream))) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while reading from stream: %s\n", pgm_name, strerror (err));
+			exit (EXIT_FAILURE);
+		}
+		if (i > 0 && (err = rle_reset (ctx)) != RLE_OK)
+		{
+			(void) compress_failed (err, &sink);
+			exit (EXIT_FAILURE);
+		}
+
+		job->out_offset = pos;
+		if (compress_stream (job, ctx, &sink) != 0)
+		{
+			exit (EXIT_FAILURE);
+		}
+		pos += job->out_ccount;
+
+		if (close_stream (job) != 0)
+		{
+			exit (EXIT_FAILURE);
+		}
+		(void) output_summary (job->in_name, archive_name, job->in_ccount, job->out_ccount);
+	}
+
+	/* File table, the trailer points back to its first entry */
+	for (int i = 0; i < job_count; i++)
+	{
+		n = put_varint (buf, strlen (jobs[i].in_name));
+		(void) put_u64 (buf + n, jobs[i].out_offset);
+		(void) put_u64 (buf + n + 8, jobs[i].out_ccount);
+		(void) put_u64 (buf + n + 16, jobs[i].in_ccount);
+		if (write_output (&sink, (char *) buf, n) != 0
+			|| write_output (&sink, jobs[i].in_name, strlen (jobs[i].in_name)) != 0
+			|| write_output (&sink, (char *) buf + n, 3 * 8) != 0)
+		{
+			(void) compress_failed (RLE_ERROR_SINK, &sink);
+			exit (EXIT_FAILURE);
+		}
+	}
+	(void) put_u64 (buf, pos);
+	(void) put_u64 (buf + 8, (uint64_t) job_count);
+	(void) memcpy (buf + 16, COMP_TABLE_MAGIC, COMP_MAGIC_LEN);
+	if (write_output (&sink, (char *) buf, COMP_TRAILER_LEN) != 0)
+	{
+		(void) compress_failed (RLE_ERROR_SINK, &sink);
+		exit (EXIT_FAILURE);
+	}
+
+	if ((sink.error = ringio_flush (sink.io)) != 0)
+	{
+		(void) compress_failed (RLE_ERROR_SINK, &sink);
+		exit (EXIT_FAILURE);
+	}
+
+	/* One fsync for the whole archive */
+	if (fsync (fd) == -1)
+	{
+		(void) fprintf(stderr, "%s: Error while syncing stream: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+	if (close (fd) == -1)
+	{
+		(void) fprintf(stderr, "%s: Error while closing stream: %s\n", pgm_name, strerror (errno));
+		exit (EXIT_FAILURE);
+	}
+
+	(void) ringio_free (sink.io);
+	(void) rle_free (ctx);
+}
+
+
+int init_compression (struct rle_context** ctx, rle_sink sink, void* opaque)
+{
+	struct rle_options options;
+	int err;
+
+	options.format = format == 2 ? RLE_FORMAT_BINARY : RLE_FORMAT_LEGACY;
+	options.threads = threads;
+	options.index_interval = index_interval;
+	options.level = level;
+	options.checksum = format == 2;
+	if ((err = rle_init (ctx, &options, sink, opaque)) != RLE_OK)
+	{
+		return compress_failed (err, NULL);
+	}
+
+	return 0;
+}
+
+
+size_t input_size (void)
+{
+	/* With more threads every read fills a chunk for each of them, both are a multiple of COMP_BLOCK_SIZE */
+	return threads > 1 ? (size_t) threads * RLE_CHUNK_SIZE : READ_BUF_SIZE;
+}
+
+
+int compress_stream (struct s_io_information* job, struct rle_context* ctx, struct s_sink* sink)
+{
+	struct timespec start, now, last;
+	const unsigned char *in_buf;
+	size_t in_size = input_size (), len;
+	int err;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &start);
+	last = start;
+
+	/* A mapped file is handed out in the same blocks as a stream, only the last block may be short */
+	for (;;)
+	{
+		if (job->in_map != NULL)
+		{
+			in_buf = job->in_map + rle_in_count (ctx);
+			len = job->in_map_len - (size_t) rle_in_count (ctx);
+			len = len > in_size ? in_size : len;
+		}
+		else if ((err = ringio_read (sink->io, &in_buf, &len)) != 0)
+		{
+			(void) fprintf(stderr, "%s: Error while reading from stream: %s\n", pgm_name, strerror (err));
+			return -1;
+		}
+		if (len == 0)
+		{
+			break;
+		}
+
+		if ((err = rle_update (ctx, in_buf, len)) != RLE_OK)
+		{
+			return compress_failed (err, sink);
+		}
+
+		if (stats)
+		{
+			(void) clock_gettime (CLOCK_MONOTONIC, &now);
+			if ((now.tv_sec - last.tv_sec) * 1000000000L + (now.tv_nsec - last.tv_nsec) >= STATS_INTERVAL * 1000000000L)
+			{
+				(void) print_stats (job, rle_in_count (ctx), rle_out_count (ctx), &start);
+				last = now;
+			}
+		}
+	}
+
+	if ((err = rle_finish (ctx)) != RLE_OK)
+	{
+		return compress_failed (err, sink);
+	}
+
+	job->in_ccount = rle_in_count (ctx);
+	job->out_ccount = rle_out_count (ctx);
+
+	if (stats)
+	{
+		(void) print_stats (job, job->in_ccount, job->out_ccount, &start);
+	}
+
+	return 0;
+}
+
+
+int compress_failed (int err, const struct s_sink* sink)
+{
+	if (err == RLE_ERROR_SINK)
+	{
+		(void) fprintf(stderr, "%s: Error while writing to stream: %s\n", pgm_name, strerror (sink->error));
+	}
+	else
+	{
+		(void) fprintf(stderr, "%s: Error while compressing: %s\n", pgm_name, rle_strerror (err));
+	}
+
+	return -1;
+}
+
+
+void print_stats (const struct s_io_information* job, uint64_t in_ccount, uint64_t out_ccount,
+	const struct timespec* start)
+{
+	struct timespec now;
+	double seconds;
+
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+	seconds = (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+
+	(void) fprintf(stderr, "%s: %" PRIu64 " chars in, %" PRIu64 " chars out, %.1f MB/s\n", job->in_name, in_ccount,
+		out_ccount, seconds > 0 ? (double) in_ccount / seconds / 1e6 : 0.0);
+}
+
+
+int write_output (void* opaque, const char* buf, size_t len)
+{
+	struct s_sink *sink = opaque;
+
+	//Could not write to file
+	if ((sink->error = ringio_write (sink->io, buf, len)) != 0)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+size_t put_varint (unsigned char* dst, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80)
+	{
+		dst[n++] = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	dst[n++] = (unsigned char) v;
+
+	return n;
+}
+
+
+void put_u64 (unsigned char* dst, uint64_t v)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		dst[i] = (unsigned char) (v >> (8 * i));
+	}
+}
+
+
+void output_summary (char* in_name, char* out_name, uint64_t in_ccount, uint64_t out_ccount)
+{
+	/* Both names are padded to the longer one, that is out_name unless it is an archive */
+	int in_len = (int) strlen (in_name), out_len = (int) strlen (out_name);
+	int width = in_len > out_len ? in_len : out_len;
 
-	free (in);
-	free (out);
+	(void) fprintf(stdout, "%s: %*s%" PRIu64 "\n%s: %*s%" PRIu64 "\n", in_name, width - in_len, "", in_ccount,
+			out_name, width - out_len, "", out_ccount);
 }
@@ -0,0 +1,1471 @@
+/**
+ * @file myuncompress.c
+ * @author Constantin Schieber, e1228774
+ * @brief Restores the original input from the .comp files of mycompress
+ * @details Reads .comp files in the legacy format (char followed by its decimal count) or in the binary format of
+ * comp_format.h and writes the original chars to stdout, like myexpand does with its output. Runs are expanded with
+ * memset into a large output buffer that is written with one write(2) once it is full. Blocks of files with
+ * COMP_FLAG_CRC are checked against their CRC right after they are decoded, before anything of them is written.
+ *
+ * With -j the input is decoded by several threads when it is a regular file and stdout is a regular file as well.
+ * The raw length of every block (binary format) or of every part of the token stream (legacy format) is summed up
+ * first, the prefix sums are the offsets where the threads write their output with pwrite(2).
+ *
+ * With -r only a range of the original input is written. The block index of the binary format leads straight to
+ * the block that holds the start of the range, files without an index are searched by their block headers.
+ *
+ * An archive of mycompress -a is restored member after member, with -x only the member of that name is written.
+ * The file table at the end of the archive leads straight to it, -j and -r work on the member like on a file.
+ *
+ * The legacy format can only be decoded if the original input had no digits, a digit after a count can't be told
+ * apart from the count itself.
+ * @date 17.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "comp_format.h"
+#include "crc32c.h"
+#include "huff.h"
+
+/* === Constants === */
+
+/* Size of the blocks that are read from a streamed input */
+#define READ_BUF_SIZE (1 << 20)
+
+/* Size of the output buffer, it has to hold at least one block of the binary format */
+#define WRITE_BUF_SIZE (2 << 20)
+
+/* Upper limit for -j */
+#define MAX_THREADS (256)
+
+/* Smallest part of a legacy token stream that is worth a thread */
+#define MIN_SEGMENT_SIZE (64 << 10)
+
+/* === Structures === */
+
+/* A compressed input, either mapped as a whole or read block by block into buf */
+struct s_input
+{
+	int fd;
+	const unsigned char *data;	/*< The mapping or buf */
+	size_t len;
+	size_t pos;
+	unsigned char *buf;		/*< NULL if the input is mapped */
+	int crc;			/*< Binary format: the payloads are followed by a CRC */
+};
+
+/* Buffered output, positional outputs are written with pwrite(2) at offset */
+struct s_output
+{
+	int fd;
+	char *buf;
+	size_t size;
+	size_t pos;
+	int positional;
+	off_t offset;
+};
+
+/* One block of the binary format */
+struct s_block
+{
+	int mode;
+	const unsigned char *payload;
+	size_t payload_len;
+	size_t raw_len;
+	int has_crc;
+	uint32_t crc;		/*< The CRC-32C of the raw chars if has_crc is set */
+};
+
+/* The part of the input one thread decodes and the offset of its output */
+struct s_segment
+{
+	const unsigned char *data;	/*< Legacy format: the tokens of the segment */
+	size_t len;
+	const struct s_block *blocks;	/*< Binary format: the blocks of the segment */
+	size_t block_count;
+	uint64_t raw_len;
+	off_t offset;
+};
+
+/* === Global Variables === */
+
+/* Name of the program */
+static const char *pgm_name = "myuncompress";
+
+/* Amount of threads that decode one input, set with -j */
+static int threads = 1;
+
+/* Buffered stdout */
+static struct s_output out;
+
+/* stdout is a regular file that can be written with pwrite(2) */
+static int out_seekable;
+
+/* Range of the original input that is written, set with -r */
+static int have_range;
+static uint64_t range_first, range_length;
+
+/* Member of an archive that is written, set with -x */
+static const char *member_name;
+
+/* === Prototypes === */
+
+/**
+ * @brief Terminates the program with a message on stderr
+ * @param exitcode The exit code
+ * @param fmt The format string of the message
+ */
+static void bail_out (int exitcode, const char *fmt, ...);
+
+/**
+ * @brief Terminates the program because the input is not a valid .comp file
+ * @param what What is wrong with the input
+ */
+static void corrupt (const char *what);
+
+/**
+ * @brief Flushes stdout when the program terminates
+ */
+static void cleanup (void);
+
+/**
+ * @brief Prints the Synopsis for calling the program and terminates
+ */
+static void usage (void);
+
+/**
+ * @brief Decodes one input and writes it to stdout
+ * @param name The name of the input, NULL for stdin
+ */
+static void decode_file (const char *name);
+
+/**
+ * @brief Decodes one compressed stream in either format
+ * @param in A reference to the input, nothing of it is consumed yet
+ * @param name The name of the input for messages
+ */
+static void decode_stream (struct s_input *in, const char *name);
+
+/**
+ * @brief Decodes the members of an archive, all of them or member_name
+ * @param in A reference to the mapped archive
+ * @param name The name of the archive for messages
+ */
+static void decode_archive (struct s_input *in, const char *name);
+
+/**
+ * @brief Decodes a binary format stream block by block
+ * @param in A reference to the input, positioned behind the file header
+ * @param dst A reference to the output
+ */
+static void decode_v2 (struct s_input *in, struct s_output *dst);
+
+/**
+ * @brief Writes a range of the original input of a mapped binary format stream
+ * @details Only the blocks that overlap the range are decoded.
+ * @param in A reference to the mapped input, positioned behind the file header
+ * @param flags The flags of the file header
+ */
+static void decode_range (struct s_input *in, int flags);
+
+/**
+ * @brief Positions the input at the last indexed block that starts at or before an offset of the original input
+ * @param in A reference to the mapped input
+ * @param first The offset in the original input
+ * @return The offset of that block in the original input
+ */
+static uint64_t seek_index (struct s_input *in, uint64_t first);
+
+/**
+ * @brief Decodes a legacy format stream
+ * @param in A reference to the input
+ * @param dst A reference to the output
+ */
+static void decode_legacy (struct s_input *in, struct s_output *dst);
+
+/**
+ * @brief Decodes a mapped binary format stream with several threads
+ * @param in A reference to the mapped input, positioned behind the file header
+ */
+static void decode_v2_parallel (struct s_input *in);
+
+/**
+ * @brief Decodes a mapped legacy format stream with several threads
+ * @param in A reference to the mapped input
+ */
+static void decode_legacy_parallel (struct s_input *in);
+
+/**
+ * @brief Runs one thread per segment and writes their output at the offset of the segment
+ * @param segments The segments, their raw_len has to be set
+ * @param count The amount of segments
+ * @param routine The thread routine, it gets a struct s_segment
+ */
+static void run_segments (struct s_segment *segments, int count, void *(*routine) (void *));
+
+/**
+ * @brief Thread routine that decodes the blocks of a segment of the binary format
+ * @param arg A reference to the struct s_segment
+ * @return NULL
+ */
+static void *decode_v2_segment (void *arg);
+
+/**
+ * @brief Thread routine that decodes a segment of the legacy format
+ * @param arg A reference to the struct s_segment
+ * @return NULL
+ */
+static void *decode_legacy_segment (void *arg);
+
+/**
+ * @brief Thread routine that sums up the counts of a segment of the legacy format
+ * @param arg A reference to the struct s_segment, raw_len is set to the sum
+ * @return NULL
+ */
+static void *count_legacy_segment (void *arg);
+
+/**
+ * @brief Decodes the payload of one block of the binary format
+ * @details Huffman coded tokens are decoded into tokens first, the buffer for them is allocated on first use. The
+ * decoded chars are checked against the CRC of the block, a mismatch terminates.
+ * @param dst A reference to the output, exactly raw_len chars of the block are written
+ * @param b A reference to the block
+ * @param tokens A reference to the token buffer of the caller, NULL until it is allocated
+ * @return 0 on success, -1 if the payload is corrupt
+ */
+static int decode_block (char *dst, const struct s_block *b, unsigned char **tokens);
+
+/**
+ * @brief Expands the tokens of one block of the binary format
+ * @param dst A reference to the output, exactly raw_len chars are written
+ * @param raw_len The amount of chars of the block
+ * @param p A reference to the payload
+ * @param len The length of the payload
+ * @return 0 on success, -1 if the payload is corrupt
+ */
+static int decode_tokens (char *dst, size_t raw_len, const unsigned char *p, size_t len);
+
+/**
+ * @brief Reads the header of the next block of the binary format
+ * @details The payload is not consumed and payload stays unset. Terminates on a corrupt header.
+ * @param in A reference to the input
+ * @param b A reference to the block
+ * @return 0 at the end of the stream, 1 otherwise
+ */
+static int in_block (struct s_input *in, struct s_block *b);
+
+/**
+ * @brief Consumes the payload of a block of the binary format and the CRC behind it
+ * @param in A reference to the input
+ * @param b A reference to the block read by in_block(), payload and the CRC are set
+ * @param scratch A reference to a buffer of COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE) + COMP_CRC_LEN chars, only used if
+ * the input is not mapped
+ */
+static void in_payload (struct s_input *in, struct s_block *b, unsigned char *scratch);
+
+/**
+ * @brief Reads an unsigned 64 bit little endian integer
+ * @param p A reference to the 8 chars
+ * @return The value
+ */
+static uint64_t read_u64 (const unsigned char *p);
+
+/**
+ * @brief Reads an unsigned LEB128 varint from a buffer
+ * @param p A reference to the buffer
+ * @param len The amount of chars in the buffer
+ * @param v A reference to the decoded value
+ * @return The amount of chars of the varint, 0 if it is truncated or too long
+ */
+static size_t read_varint (const unsigned char *p, size_t len, uint64_t *v);
+
+/**
+ * @brief Reads the next block of a streamed input
+ * @param in A reference to the input, only called once every char of the input was consumed
+ * @return 0 at the end of the input, 1 otherwise
+ */
+static int in_fill (struct s_input *in);
+
+/**
+ * @brief Returns the next char of the input
+ * @param in A reference to the input
+ * @return The char or -1 at the end of the input
+ */
+static int in_byte (struct s_input *in);
+
+/**
+ * @brief Returns the next varint of the input, terminates on corrupt input
+ * @param in A reference to the input
+ * @return The value
+ */
+static uint64_t in_varint (struct s_input *in);
+
+/**
+ * @brief Returns the next len chars of the input
+ * @details If the chars are not contiguous in the input they are copied to scratch.
+ * @param in A reference to the input
+ * @param scratch A reference to a buffer of at least len chars
+ * @param len The amount of chars
+ * @return A reference to the chars, terminates if the input ends before
+ */
+static const unsigned char *in_bytes (struct s_input *in, unsigned char *scratch, size_t len);
+
+/**
+ * @brief Returns room for len chars in the output buffer, flushes it first if needed
+ * @param dst A reference to the output
+ * @param len The amount of chars, at most the size of the buffer
+ * @return A reference to the free room, the caller advances pos
+ */
+static char *out_reserve (struct s_output *dst, size_t len);
+
+/**
+ * @brief Appends chars to the output
+ * @param dst A reference to the output
+ * @param p A reference to the chars
+ * @param len The amount of chars
+ */
+static void out_bytes (struct s_output *dst, const char *p, size_t len);
+
+/**
+ * @brief Appends a run of len times c to the output
+ * @param dst A reference to the output
+ * @param c The char
+ * @param len The length of the run
+ */
+static void out_run (struct s_output *dst, int c, uint64_t len);
+
+/**
+ * @brief Writes the buffered output
+ * @param dst A reference to the output
+ */
+static void out_flush (struct s_output *dst);
+
+/**
+ * @brief Writes a buffer to the output, at its offset if the output is positional
+ * @param dst A reference to the output
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ */
+static void out_write (struct s_output *dst, const char *buf, size_t len);
+
+/**
+ * @brief Initializes an output with its own buffer
+ * @param dst A reference to the output
+ * @param fd The file descriptor
+ * @param positional Write with pwrite(2) starting at offset
+ * @param offset The offset of the first char
+ */
+static void out_init (struct s_output *dst, int fd, int positional, off_t offset);
+
+
+/**
+ * The main entry point of the program.
+ *
+ * @param argc The number of command-line parameters in argv.
+ * @param argv The array of command-line paramters, argc elements long.
+ * @return The exit code of the program. 0 on success, non-zero on failure.
+ */
+int main (int argc, char **argv)
+{
+	struct stat st;
+	char *end;
+	long n;
+	int opt;
+
+	pgm_name = argv[0];
+
+	while ((opt = getopt (argc, argv, "j:r:x:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'x':
+				member_name = optarg;
+				break;
+			case 'r':
+				errno = 0;
+				range_first = strtoull (optarg, &end, 10);
+				if (errno != 0 || end == optarg || *end != ':')
+				{
+					usage ();
+				}
+				optarg = end + 1;
+				range_length = strtoull (optarg, &end, 10);
+				if (errno != 0 || end == optarg || *end != '\0')
+				{
+					usage ();
+				}
+				have_range = 1;
+				break;
+			case 'j':
+				errno = 0;
+				n = strtol (optarg, &end, 10);
+				if (errno != 0 || *end != '\0' || n < 1 || n > MAX_THREADS)
+				{
+					usage ();
+				}
+				threads = (int) n;
+				break;
+			default:
+				usage ();
+		}
+	}
+
+	(void) out_init (&out, STDOUT_FILENO, 0, 0);
+	(void) atexit (cleanup);
+
+	/* Threads write at their final offsets, that only works for a regular file that isn't opened for appending */
+	out_seekable = fstat (STDOUT_FILENO, &st) == 0 && S_ISREG (st.st_mode)
+		&& lseek (STDOUT_FILENO, 0, SEEK_CUR) != (off_t) -1
+		&& (fcntl (STDOUT_FILENO, F_GETFL) & O_APPEND) == 0;
+
+	if (optind < argc)
+	{
+		for (int i = optind; i < argc; i++)
+		{
+			(void) decode_file (argv[i]);
+		}
+	}
+	else
+	{
+		(void) decode_file (NULL);
+	}
+
+	(void) out_flush (&out);
+
+	exit (EXIT_SUCCESS);
+}
+
+
+static void bail_out (int exitcode, const char *fmt, ...)
+{
+	va_list ap;
+
+	(void) fprintf (stderr, "%s: ", pgm_name);
+	if (fmt != NULL)
+	{
+		va_start (ap, fmt);
+		(void) vfprintf (stderr, fmt, ap);
+		va_end (ap);
+	}
+	if (errno != 0)
+	{
+		(void) fprintf (stderr, ": %s", strerror (errno));
+	}
+	(void) fprintf (stderr, "\n");
+
+	exit (exitcode);
+}
+
+
+static void corrupt (const char *what)
+{
+	errno = 0;
+	bail_out (EXIT_FAILURE, "Corrupt input: %s", what);
+}
+
+
+static void cleanup (void)
+{
+	/* Whatever was decoded before an error is still written */
+	if (out.buf != NULL && out.pos > 0)
+	{
+		(void) write (out.fd, out.buf, out.pos);
+		out.pos = 0;
+	}
+}
+
+
+static void usage (void)
+{
+	(void) fprintf (stderr, "Usage: %s [-j threads] [-r offset:length] [-x member] [file ...]\n", pgm_name);
+	exit (EXIT_FAILURE);
+}
+
+
+static void decode_file (const char *name)
+{
+	struct s_input in;
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	(void) memset (&in, 0, sizeof (in));
+	in.fd = STDIN_FILENO;
+
+	if (name != NULL && (in.fd = open (name, O_RDONLY)) == -1)
+	{
+		bail_out (EXIT_FAILURE, "Error opening %s", name);
+	}
+
+	/* Regular files are mapped, everything else is read block by block */
+	if (fstat (in.fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0 && name != NULL
+		&& (unsigned long long) st.st_size <= (size_t) -1)
+	{
+		map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, in.fd, 0);
+	}
+	if (map != MAP_FAILED)
+	{
+		(void) madvise (map, (size_t) st.st_size, MADV_SEQUENTIAL);
+		in.data = map;
+		in.len = (size_t) st.st_size;
+	}
+	else
+	{
+		if ((in.buf = malloc (READ_BUF_SIZE)) == NULL)
+		{
+			bail_out (EXIT_FAILURE, "Error while allocating memory");
+		}
+		in.data = in.buf;
+		(void) in_fill (&in);
+	}
+
+	/* The first fill has the whole header unless the input is shorter */
+	errno = 0;
+	if (in.len >= COMP_ARCHIVE_HEADER_LEN && memcmp (in.data, COMP_ARCHIVE_MAGIC, COMP_MAGIC_LEN) == 0)
+	{
+		if (in.buf != NULL)
+		{
+			bail_out (EXIT_FAILURE, "an archive needs a regular file");
+		}
+		(void) decode_archive (&in, name);
+	}
+	else if (member_name != NULL)
+	{
+		bail_out (EXIT_FAILURE, "-x needs an archive");
+	}
+	else
+	{
+		(void) decode_stream (&in, name ? name : "stdin");
+	}
+
+	if (map != MAP_FAILED)
+	{
+		(void) munmap (map, in.len);
+	}
+	free (in.buf);
+	if (in.fd != STDIN_FILENO)
+	{
+		(void) close (in.fd);
+	}
+}
+
+
+static void decode_stream (struct s_input *in, const char *name)
+{
+	errno = 0;
+	if (in->len >= COMP_HEADER_LEN && memcmp (in->data, COMP_MAGIC, COMP_MAGIC_LEN) == 0)
+	{
+		if (in->data[COMP_MAGIC_LEN] != COMP_VERSION)
+		{
+			bail_out (EXIT_FAILURE, "%s: unsupported version %d", name, in->data[COMP_MAGIC_LEN]);
+		}
+		if ((in->data[COMP_MAGIC_LEN + 1] & ~COMP_FLAGS_KNOWN) != 0)
+		{
+			bail_out (EXIT_FAILURE, "%s: unsupported flags 0x%02x", name, in->data[COMP_MAGIC_LEN + 1]);
+		}
+		in->pos = COMP_HEADER_LEN;
+		in->crc = (in->data[COMP_MAGIC_LEN + 1] & COMP_FLAG_CRC) != 0;
+
+		if (have_range)
+		{
+			if (in->buf != NULL)
+			{
+				bail_out (EXIT_FAILURE, "-r needs a regular file");
+			}
+			(void) decode_range (in, in->data[COMP_MAGIC_LEN + 1]);
+		}
+		else if (threads > 1 && in->buf == NULL && out_seekable)
+		{
+			(void) decode_v2_parallel (in);
+		}
+		else
+		{
+			(void) decode_v2 (in, &out);
+		}
+	}
+	else if (have_range)
+	{
+		bail_out (EXIT_FAILURE, "-r needs a .comp file in the binary format");
+	}
+	else if (threads > 1 && in->buf == NULL && out_seekable)
+	{
+		(void) decode_legacy_parallel (in);
+	}
+	else
+	{
+		(void) decode_legacy (in, &out);
+	}
+}
+
+
+static void decode_archive (struct s_input *in, const char *name)
+{
+	const unsigned char *trailer, *p, *end;
+	uint64_t table_offset, count, i;
+	int found = 0;
+
+	if (in->data[COMP_MAGIC_LEN] != COMP_ARCHIVE_VERSION)
+	{
+		bail_out (EXIT_FAILURE, "%s: unsupported archive version %d", name, in->data[COMP_MAGIC_LEN]);
+	}
+	if (in->len < COMP_ARCHIVE_HEADER_LEN + COMP_TRAILER_LEN)
+	{
+		corrupt ("missing file table");
+	}
+	trailer = in->data + in->len - COMP_TRAILER_LEN;
+	table_offset = read_u64 (trailer);
+	count = read_u64 (trailer + 8);
+	if (memcmp (trailer + 16, COMP_TABLE_MAGIC, COMP_MAGIC_LEN) != 0 || table_offset < COMP_ARCHIVE_HEADER_LEN
+		|| table_offset > in->len - COMP_TRAILER_LEN)
+	{
+		corrupt ("bad file table");
+	}
+
+	/* Every member is decoded from a view into the mapping of the archive */
+	p = in->data + table_offset;
+	end = trailer;
+	for (i = 0; i < count; i++)
+	{
+		uint64_t name_len, offset, len;
+		struct s_input member;
+		size_t n;
+
+		if ((n = read_varint (p, (size_t) (end - p), &name_len)) == 0 || name_len > (uint64_t) (end - p - n)
+			|| 3 * 8 > end - p - n - (ptrdiff_t) name_len)
+		{
+			corrupt ("bad file table");
+		}
+		p += n;
+		offset = read_u64 (p + name_len);
+		len = read_u64 (p + name_len + 8);
+		if (offset < COMP_ARCHIVE_HEADER_LEN || offset > table_offset || len > table_offset - offset)
+		{
+			corrupt ("bad file table");
+		}
+
+		if (member_name == NULL || (strlen (member_name) == name_len && memcmp (p, member_name, name_len) == 0))
+		{
+			(void) memset (&member, 0, sizeof (member));
+			member.fd = in->fd;
+			member.data = in->data + offset;
+			member.len = (size_t) len;
+			(void) decode_stream (&member, name);
+			found = 1;
+		}
+		p += name_len + 3 * 8;
+
+		if (found && member_name != NULL)
+		{
+			return;
+		}
+	}
+
+	if (member_name != NULL)
+	{
+		errno = 0;
+		bail_out (EXIT_FAILURE, "%s: no member %s", name, member_name);
+	}
+}
+
+
+static void decode_v2 (struct s_input *in, struct s_output *dst)
+{
+	unsigned char *scratch = NULL, *tokens = NULL;
+	struct s_block b;
+
+	while (in_block (in, &b))
+	{
+		if (scratch == NULL && in->buf != NULL
+			&& (scratch = malloc (COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE) + COMP_CRC_LEN)) == NULL)
+		{
+			bail_out (EXIT_FAILURE, "Error while allocating memory");
+		}
+		(void) in_payload (in, &b, scratch);
+
+		if (decode_block (out_reserve (dst, b.raw_len), &b, &tokens) == -1)
+		{
+			corrupt ("bad block payload");
+		}
+		dst->pos += b.raw_len;
+	}
+
+	free (scratch);
+	free (tokens);
+}
+
+
+static void decode_range (struct s_input *in, int flags)
+{
+	uint64_t raw = 0, last = range_first + range_length;
+	unsigned char *tokens = NULL;
+	struct s_block b;
+	char *block;
+
+	if ((block = malloc (COMP_BLOCK_SIZE)) == NULL)
+	{
+		bail_out (EXIT_FAILURE, "Error while allocating memory");
+	}
+	if (last < range_first)
+	{
+		last = UINT64_MAX;
+	}
+
+	if ((flags & COMP_FLAG_INDEX) != 0)
+	{
+		raw = seek_index (in, range_first);
+	}
+
+	/* Blocks in front of the range are skipped by their header */
+	while (raw < last && in_block (in, &b))
+	{
+		(void) in_payload (in, &b, NULL);
+
+		if (raw + b.raw_len > range_first)
+		{
+			uint64_t from = range_first > raw ? range_first - raw : 0;
+			uint64_t to = last - raw < b.raw_len ? last - raw : b.raw_len;
+
+			if (decode_block (block, &b, &tokens) == -1)
+			{
+				corrupt ("bad block payload");
+			}
+			(void) out_bytes (&out, block + from, (size_t) (to - from));
+		}
+		raw += b.raw_len;
+	}
+
+	free (block);
+	free (tokens);
+}
+
+
+static uint64_t seek_index (struct s_input *in, uint64_t first)
+{
+	const unsigned char *trailer, *entries;
+	uint64_t index_offset, count, lo, hi;
+
+	if (in->len < COMP_HEADER_LEN + COMP_TRAILER_LEN)
+	{
+		corrupt ("missing index");
+	}
+	trailer = in->data + in->len - COMP_TRAILER_LEN;
+	index_offset = read_u64 (trailer);
+	count = read_u64 (trailer + 8);
+	if (memcmp (trailer + 16, COMP_INDEX_MAGIC, COMP_MAGIC_LEN) != 0 || count == 0
+		|| index_offset < COMP_HEADER_LEN || index_offset > in->len - COMP_TRAILER_LEN
+		|| count != (in->len - COMP_TRAILER_LEN - index_offset) / COMP_INDEX_ENTRY_LEN
+		|| (in->len - COMP_TRAILER_LEN - index_offset) % COMP_INDEX_ENTRY_LEN != 0)
+	{
+		corrupt ("bad index");
+	}
+	entries = in->data + index_offset;
+
+	/* Last entry that starts at or before first, the first entry is always at 0 */
+	lo = 0;
+	hi = count;
+	while (hi - lo > 1)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (read_u64 (entries + mid * COMP_INDEX_ENTRY_LEN) <= first)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	in->pos = (size_t) read_u64 (entries + lo * COMP_INDEX_ENTRY_LEN + 8);
+	if (in->pos < COMP_HEADER_LEN || in->pos >= index_offset)
+	{
+		corrupt ("bad index");
+	}
+
+	return read_u64 (entries + lo * COMP_INDEX_ENTRY_LEN);
+}
+
+
+static void decode_legacy (struct s_input *in, struct s_output *dst)
+{
+	int c = -1, digits = 0;
+	uint64_t count = 0;
+
+	/* A token is a char followed by at least one digit, the next non-digit starts the next token */
+	while (in->pos < in->len || in_fill (in))
+	{
+		const unsigned char *p = in->data + in->pos, *end = in->data + in->len;
+
+		while (p < end)
+		{
+			if (c == -1)
+			{
+				c = *p++;
+				count = 0;
+				digits = 0;
+			}
+			else if (*p >= '0' && *p <= '9')
+			{
+				if (count > (UINT64_MAX - 9) / 10)
+				{
+					corrupt ("count too large");
+				}
+				count = count * 10 + (uint64_t) (*p++ - '0');
+				digits++;
+			}
+			else
+			{
+				if (digits == 0 || count == 0)
+				{
+					corrupt ("char without count");
+				}
+				(void) out_run (dst, c, count);
+				c = -1;
+			}
+		}
+		in->pos = in->len;
+	}
+
+	if (c != -1)
+	{
+		if (digits == 0 || count == 0)
+		{
+			corrupt ("char without count");
+		}
+		(void) out_run (dst, c, count);
+	}
+}
+
+
+static void decode_v2_parallel (struct s_input *in)
+{
+	struct s_segment segments[MAX_THREADS];
+	struct s_block *blocks = NULL, block;
+	size_t block_count = 0, block_size = 0, per_segment, b;
+	int count = 0;
+
+	/* Walk the block headers, the payloads are skipped */
+	while (in_block (in, &block))
+	{
+		(void) in_payload (in, &block, NULL);
+
+		if (block_count == block_size)
+		{
+			block_size = block_size == 0 ? 64 : 2 * block_size;
+			if ((blocks = realloc (blocks, block_size * sizeof (*blocks))) == NULL)
+			{
+				bail_out (EXIT_FAILURE, "Error while allocating memory");
+			}
+		}
+		blocks[block_count++] = block;
+	}
+
+	/* Contiguous runs of blocks per thread, the raw lengths add up to the offset of each segment */
+	per_segment = (block_count + (size_t) threads - 1) / (size_t) threads;
+	for (b = 0; b < block_count; b += per_segment)
+	{
+		struct s_segment *s = &segments[count++];
+		size_t i;
+
+		s->blocks = blocks + b;
+		s->block_count = block_count - b < per_segment ? block_count - b : per_segment;
+		s->raw_len = 0;
+		for (i = 0; i < s->block_count; i++)
+		{
+			s->raw_len += s->blocks[i].raw_len;
+		}
+	}
+
+	(void) run_segments (segments, count, decode_v2_segment);
+	free (blocks);
+}
+
+
+static void decode_legacy_parallel (struct s_input *in)
+{
+	struct s_segment segments[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	size_t start = 0, len = in->len;
+	int count = 0, i, err;
+
+	/* Cut the token stream into one segment per thread. A segment starts at the char behind the last digit of a
+	 * count.
+	 */
+	while (start < len && count < threads)
+	{
+		size_t target = start + (len - start) / (size_t) (threads - count), p;
+
+		if (target - start < MIN_SEGMENT_SIZE || count == threads - 1)
+		{
+			target = len;
+		}
+		for (p = target; p < len; p++)
+		{
+			if (in->data[p - 1] >= '0' && in->data[p - 1] <= '9' && (in->data[p] < '0' || in->data[p] > '9'))
+			{
+				break;
+			}
+		}
+
+		segments[count].data = in->data + start;
+		segments[count].len = p - start;
+		count++;
+		start = p;
+	}
+
+	/* First pass: the sum of the counts of every segment */
+	for (i = 1; i < count; i++)
+	{
+		if ((err = pthread_create (&tids[i], NULL, count_legacy_segment, &segments[i])) != 0)
+		{
+			errno = err;
+			bail_out (EXIT_FAILURE, "Error while creating thread");
+		}
+	}
+	if (count > 0)
+	{
+		(void) count_legacy_segment (&segments[0]);
+	}
+	for (i = 1; i < count; i++)
+	{
+		if ((err = pthread_join (tids[i], NULL)) != 0)
+		{
+			errno = err;
+			bail_out (EXIT_FAILURE, "Error while joining thread");
+		}
+	}
+
+	/* Second pass: every segment is expanded at its offset */
+	(void) run_segments (segments, count, decode_legacy_segment);
+}
+
+
+static void run_segments (struct s_segment *segments, int count, void *(*routine) (void *))
+{
+	pthread_t tids[MAX_THREADS];
+	off_t base, offset;
+	int i, err;
+
+	(void) out_flush (&out);
+	if ((base = lseek (out.fd, 0, SEEK_CUR)) == (off_t) -1)
+	{
+		bail_out (EXIT_FAILURE, "Error while seeking stdout");
+	}
+
+	/* The prefix sums of the raw lengths are the offsets of the segments */
+	offset = base;
+	for (i = 0; i < count; i++)
+	{
+		segments[i].offset = offset;
+		offset += (off_t) segments[i].raw_len;
+	}
+
+	for (i = 1; i < count; i++)
+	{
+		if ((err = pthread_create (&tids[i], NULL, routine, &segments[i])) != 0)
+		{
+			errno = err;
+			bail_out (EXIT_FAILURE, "Error while creating thread");
+		}
+	}
+	if (count > 0)
+	{
+		(void) routine (&segments[0]);
+	}
+	for (i = 1; i < count; i++)
+	{
+		if ((err = pthread_join (tids[i], NULL)) != 0)
+		{
+			errno = err;
+			bail_out (EXIT_FAILURE, "Error while joining thread");
+		}
+	}
+
+	/* The next input continues behind this one */
+	if (lseek (out.fd, offset, SEEK_SET) == (off_t) -1)
+	{
+		bail_out (EXIT_FAILURE, "Error while seeking stdout");
+	}
+}
+
+
+static void *decode_v2_segment (void *arg)
+{
+	struct s_segment *s = arg;
+	struct s_output dst;
+	unsigned char *tokens = NULL;
+	size_t i;
+
+	(void) out_init (&dst, out.fd, 1, s->offset);
+
+	for (i = 0; i < s->block_count; i++)
+	{
+		const struct s_block *b = &s->blocks[i];
+
+		if (decode_block (out_reserve (&dst, b->raw_len), b, &tokens) == -1)
+		{
+			corrupt ("bad block payload");
+		}
+		dst.pos += b->raw_len;
+	}
+
+	(void) out_flush (&dst);
+	free (dst.buf);
+	free (tokens);
+
+	return NULL;
+}
+
+
+static void *decode_legacy_segment (void *arg)
+{
+	struct s_segment *s = arg;
+	struct s_output dst;
+	struct s_input in;
+
+	(void) memset (&in, 0, sizeof (in));
+	in.data = s->data;
+	in.len = s->len;
+
+	(void) out_init (&dst, out.fd, 1, s->offset);
+	(void) decode_legacy (&in, &dst);
+	(void) out_flush (&dst);
+	free (dst.buf);
+
+	return NULL;
+}
+
+
+static void *count_legacy_segment (void *arg)
+{
+	struct s_segment *s = arg;
+	uint64_t sum = 0, count = 0;
+	size_t i = 0;
+
+	while (i < s->len)
+	{
+		size_t digits = 0;
+
+		/* Skip the char, then read the count */
+		for (i++, count = 0; i < s->len && s->data[i] >= '0' && s->data[i] <= '9'; i++, digits++)
+		{
+			if (count > (UINT64_MAX - 9) / 10)
+			{
+				corrupt ("count too large");
+			}
+			count = count * 10 + (uint64_t) (s->data[i] - '0');
+		}
+		if (digits == 0 || count == 0 || sum + count < sum)
+		{
+			corrupt ("char without count");
+		}
+		sum += count;
+	}
+
+	s->raw_len = sum;
+
+	return NULL;
+}
+
+
+static int decode_block (char *dst, const struct s_block *b, unsigned char **tokens)
+{
+	uint64_t token_len;
+	size_t n;
+
+	if (b->mode == COMP_MODE_RLE)
+	{
+		if (decode_tokens (dst, b->raw_len, b->payload, b->payload_len) == -1)
+		{
+			return -1;
+		}
+	}
+	else if (b->mode == COMP_MODE_STORED)
+	{
+		(void) memcpy (dst, b->payload, b->raw_len);
+	}
+	else
+	{
+		if ((n = read_varint (b->payload, b->payload_len, &token_len)) == 0
+			|| token_len > COMP_PAYLOAD_BOUND(b->raw_len))
+		{
+			return -1;
+		}
+		if (*tokens == NULL && (*tokens = malloc (COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE))) == NULL)
+		{
+			bail_out (EXIT_FAILURE, "Error while allocating memory");
+		}
+		if (huff_decode (*tokens, (size_t) token_len, b->payload + n, b->payload_len - n) == -1
+			|| decode_tokens (dst, b->raw_len, *tokens, (size_t) token_len) == -1)
+		{
+			return -1;
+		}
+	}
+
+	if (b->has_crc && crc32c (0, dst, b->raw_len) != b->crc)
+	{
+		corrupt ("checksum mismatch");
+	}
+
+	return 0;
+}
+
+
+static int decode_tokens (char *dst, size_t raw_len, const unsigned char *p, size_t len)
+{
+	size_t i = 0, o = 0;
+
+	while (i < len)
+	{
+		unsigned int t = p[i++];
+		uint64_t n;
+
+		if (t < COMP_REPEAT_FLAG)
+		{
+			/* Literal */
+			n = t + 1;
+			if (n > len - i || n > raw_len - o)
+			{
+				return -1;
+			}
+			(void) memcpy (dst + o, p + i, (size_t) n);
+			i += (size_t) n;
+		}
+		else
+		{
+			/* Repeat, possibly with a varint for the rest of the count */
+			int c;
+
+			if (i == len)
+			{
+				return -1;
+			}
+			c = p[i++];
+			n = (t & COMP_REPEAT_ESCAPE) + COMP_REPEAT_MIN;
+			if ((t & COMP_REPEAT_ESCAPE) == COMP_REPEAT_ESCAPE)
+			{
+				uint64_t extra;
+				size_t k = read_varint (p + i, len - i, &extra);
+
+				if (k == 0 || extra > raw_len)
+				{
+					return -1;
+				}
+				i += k;
+				n += extra;
+			}
+			if (n > raw_len - o)
+			{
+				return -1;
+			}
+			(void) memset (dst + o, c, (size_t) n);
+		}
+		o += (size_t) n;
+	}
+
+	return o == raw_len ? 0 : -1;
+}
+
+
+static int in_block (struct s_input *in, struct s_block *b)
+{
+	uint64_t raw_len, payload_len;
+
+	if ((b->mode = in_byte (in)) == COMP_MODE_END)
+	{
+		return 0;
+	}
+	if (b->mode == -1)
+	{
+		corrupt ("missing end of stream");
+	}
+
+	raw_len = in_varint (in);
+	payload_len = in_varint (in);
+	if ((b->mode != COMP_MODE_RLE && b->mode != COMP_MODE_HUFF && b->mode != COMP_MODE_STORED) || raw_len == 0
+		|| raw_len > COMP_BLOCK_SIZE || payload_len > COMP_PAYLOAD_BOUND(raw_len)
+		|| (b->mode == COMP_MODE_STORED && payload_len != raw_len))
+	{
+		corrupt ("bad block header");
+	}
+
+	b->raw_len = (size_t) raw_len;
+	b->payload_len = (size_t) payload_len;
+	b->payload = NULL;
+
+	return 1;
+}
+
+
+static void in_payload (struct s_input *in, struct s_block *b, unsigned char *scratch)
+{
+	/* Both at once, the payload may be in the buffer that the CRC refills */
+	const unsigned char *p = in_bytes (in, scratch, b->payload_len + (in->crc ? COMP_CRC_LEN : 0));
+
+	b->payload = p;
+	b->has_crc = in->crc;
+	if (in->crc)
+	{
+		p += b->payload_len;
+		b->crc = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+	}
+}
+
+
+static uint64_t read_u64 (const unsigned char *p)
+{
+	uint64_t v = 0;
+
+	for (int i = 7; i >= 0; i--)
+	{
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+
+static size_t read_varint (const unsigned char *p, size_t len, uint64_t *v)
+{
+	uint64_t value = 0;
+	size_t i;
+
+	for (i = 0; i < len && i < COMP_VARINT_MAX; i++)
+	{
+		value |= (uint64_t) (p[i] & 0x7f) << (7 * i);
+		if ((p[i] & 0x80) == 0)
+		{
+			*v = value;
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int in_fill (struct s_input *in)
+{
+	size_t done = 0;
+
+	if (in->buf == NULL)
+	{
+		return 0;
+	}
+
+	/* Fill the whole buffer unless the input ends */
+	while (done < READ_BUF_SIZE)
+	{
+		ssize_t n = read (in->fd, in->buf + done, READ_BUF_SIZE - done);
+
+		if (n == 0)
+		{
+			break;
+		}
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			bail_out (EXIT_FAILURE, "Error while reading from stream");
+		}
+		done += (size_t) n;
+	}
+
+	in->len = done;
+	in->pos = 0;
+
+	return done > 0;
+}
+
+
+static int in_byte (struct s_input *in)
+{
+	if (in->pos == in->len && !in_fill (in))
+	{
+		return -1;
+	}
+
+	return in->data[in->pos++];
+}
+
+
+static uint64_t in_varint (struct s_input *in)
+{
+	uint64_t v;
+	size_t k;
+	int i, c;
+
+	/* Fast path: the whole varint is in the buffer */
+	if ((k = read_varint (in->data + in->pos, in->len - in->pos, &v)) != 0)
+	{
+		in->pos += k;
+		return v;
+	}
+
+	v = 0;
+	for (i = 0; i < COMP_VARINT_MAX; i++)
+	{
+		if ((c = in_byte (in)) == -1)
+		{
+			break;
+		}
+		v |= (uint64_t) (c & 0x7f) << (7 * i);
+		if ((c & 0x80) == 0)
+		{
+			return v;
+		}
+	}
+
+	corrupt ("bad varint");
+	return 0;
+}
+
+
+static const unsigned char *in_bytes (struct s_input *in, unsigned char *scratch, size_t len)
+{
+	const unsigned char *p = in->data + in->pos;
+	size_t done = 0;
+
+	if (in->len - in->pos >= len)
+	{
+		in->pos += len;
+		return p;
+	}
+	if (in->buf == NULL)
+	{
+		corrupt ("truncated block");
+	}
+
+	/* The chars cross the end of the buffer */
+	while (done < len)
+	{
+		size_t n;
+
+		if (in->pos == in->len && !in_fill (in))
+		{
+			corrupt ("truncated block");
+		}
+		n = in->len - in->pos < len - done ? in->len - in->pos : len - done;
+		(void) memcpy (scratch + done, in->data + in->pos, n);
+		in->pos += n;
+		done += n;
+	}
+
+	return scratch;
+}
+
+
+static char *out_reserve (struct s_output *dst, size_t len)
+{
+	if (dst->size - dst->pos < len)
+	{
+		(void) out_flush (dst);
+	}
+
+	return dst->buf + dst->pos;
+}
+
+
+static void out_bytes (struct s_output *dst, const char *p, size_t len)
+{
+	if (dst->size - dst->pos < len)
+	{
+		(void) out_flush (dst);
+	}
+	if (len >= dst->size)
+	{
+		(void) out_write (dst, p, len);
+		return;
+	}
+	(void) memcpy (dst->buf + dst->pos, p, len);
+	dst->pos += len;
+}
+
+
+static void out_run (struct s_output *dst, int c, uint64_t len)
+{
+	/* A run that fills the whole buffer is set once and the buffer is written as often as needed */
+	if (len >= dst->size)
+	{
+		(void) out_flush (dst);
+		(void) memset (dst->buf, c, dst->size);
+		while (len >= dst->size)
+		{
+			(void) out_write (dst, dst->buf, dst->size);
+			len -= dst->size;
+		}
+	}
+
+	while (len > 0)
+	{
+		size_t n = dst->size - dst->pos;
+
+		if (n == 0)
+		{
+			(void) out_flush (dst);
+			n = dst->size;
+		}
+		if (n > len)
+		{
+			n = (size_t) len;
+		}
+		(void) memset (dst->buf + dst->pos, c, n);
+		dst->pos += n;
+		len -= n;
+	}
+}
+
+
+static void out_flush (struct s_output *dst)
+{
+	(void) out_write (dst, dst->buf, dst->pos);
+	dst->pos = 0;
+}
+
+
+static void out_write (struct s_output *dst, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = dst->positional ? pwrite (dst->fd, buf, len, dst->offset) : write (dst->fd, buf, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			bail_out (EXIT_FAILURE, "Couldn't write to stdout");
+		}
+		buf += n;
+		len -= (size_t) n;
+		dst->offset += n;
+	}
+}
+
+
+static void out_init (struct s_output *dst, int fd, int positional, off_t offset)
+{
+	dst->fd = fd;
+	dst->size = WRITE_BUF_SIZE;
+	dst->pos = 0;
+	dst->positional = positional;
+	dst->offset = offset;
+	if ((dst->buf = malloc (WRITE_BUF_SIZE)) == NULL)
+	{
+		bail_out (EXIT_FAILURE, "Error while allocating memory");
+	}
+}
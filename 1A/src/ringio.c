@@ -0,0 +1,830 @@
+/**
+ * @file ringio.c
+ * @author Constantin Schieber, e1228774
+ * @brief Pipelined input and output of mycompress, see ringio.h
+ * @details The io_uring is set up with the raw system calls, liburing is not needed. Buffers are used in ring order
+ * and every buffer is in one of the BUF states, so chars are handed out and written in the order of the streams.
+ * Seekable files get explicit offsets and several requests at once. Pipes get one request at a time, the kernel
+ * does not promise to complete requests without offset in order. Short reads and writes are continued with a new
+ * request for the rest of the buffer.
+ * @date 17.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "ringio.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_FAST_POLL)
+#define HAVE_IO_URING
+#endif
+#endif
+
+/* === Constants === */
+
+/* Size of an output buffer */
+#define WRITE_BUF_SIZE (1 << 20)
+
+/* Entries of the submission queue, enough for every buffer to have a request in flight */
+#define RING_ENTRIES (RINGIO_READ_BUFS + RINGIO_WRITE_BUFS + 1)
+
+/* States of a buffer */
+#define BUF_FREE (0)		/*< Input: can be read into, output: collects chars */
+#define BUF_QUEUED (1)		/*< Output: full, waits for the write of the buffer before it (pipes only) */
+#define BUF_BUSY (2)		/*< A request is in flight */
+#define BUF_READY (3)		/*< Input: read, waits to be handed out */
+#define BUF_HANDED (4)		/*< Input: handed out by ringio_read() */
+
+/* user_data of a request: the buffer index, output buffers are marked with USER_WRITE */
+#define USER_WRITE (0x100)
+
+/* === Structures === */
+
+/* One input or output buffer */
+struct s_buf
+{
+	unsigned char *data;
+	size_t len;		/*< Input: chars read so far, output: chars collected */
+	size_t done;		/*< Output: chars written so far */
+	off_t offset;		/*< Offset of data[0] in the file, -1 for pipes */
+	int state;
+};
+
+/* The mapped queues of an io_uring */
+struct s_ring
+{
+	int fd;
+#ifdef HAVE_IO_URING
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map;
+	void *cq_map;
+	size_t sq_map_len;
+	size_t cq_map_len;
+	size_t sqes_len;
+#endif
+	unsigned in_flight;
+};
+
+struct ringio
+{
+	int in_fd;
+	int out_fd;
+	int use_ring;		/*< 0 if every call blocks on read(2) and write(2) */
+	struct s_ring ring;
+	size_t buf_size;
+	struct s_buf reads[RINGIO_READ_BUFS];
+	struct s_buf writes[RINGIO_WRITE_BUFS];
+	size_t read_next;	/*< Input buffer that is handed out next */
+	size_t read_fill;	/*< Input buffer that is read into next */
+	size_t write_cur;	/*< Output buffer that collects chars */
+	size_t write_next;	/*< Oldest output buffer that is not written yet */
+	off_t in_offset;	/*< Offset of the next read, -1 for pipes */
+	off_t in_end;		/*< Offset behind the chars handed out so far, -1 for pipes */
+	off_t out_offset;	/*< Offset of the next write, -1 for pipes */
+	int eof;		/*< A read hit the end of the input */
+	int error[2];		/*< The first error of the input and of the output, 0 if there is none */
+};
+
+/* === Prototypes === */
+
+/**
+ * @brief Starts reads into the free input buffers, as many at once as the input allows
+ * @param io A reference to the pipeline
+ */
+static void start_reads (struct ringio *io);
+
+/**
+ * @brief Moves the file position of the input behind the chars that were read, once the input ends. The reads of
+ * the ring have offsets of their own and leave the position alone, but a shared stdin has to be consumed like read(2)
+ * consumes it.
+ * @param io A reference to the pipeline
+ */
+static void end_input (struct ringio *io);
+
+/**
+ * @brief Queues a full output buffer and starts its write if the output allows
+ * @param io A reference to the pipeline
+ * @param b A reference to the buffer
+ */
+static void queue_write (struct ringio *io, struct s_buf *b);
+
+/**
+ * @brief Starts the request for the rest of a buffer
+ * @param io A reference to the pipeline
+ * @param b A reference to the buffer
+ * @param write 1 for an output buffer, 0 for an input buffer
+ */
+static void submit (struct ringio *io, struct s_buf *b, int write);
+
+/**
+ * @brief Waits for at least one request and handles every completed one
+ * @param io A reference to the pipeline
+ * @param write 1 to return the error of the output, 0 for the input
+ * @return 0 or the error
+ */
+static int wait_requests (struct ringio *io, int write);
+
+/**
+ * @brief Handles the result of a request
+ * @param io A reference to the pipeline
+ * @param user_data The user_data of the request
+ * @param res The result, an amount of chars or a negative errno
+ */
+static void complete (struct ringio *io, uint64_t user_data, int res);
+
+/**
+ * @brief Reads until the buffer is full or the stream ends
+ * @param fd The file descriptor
+ * @param buf A reference to the buffer
+ * @param len The size of the buffer
+ * @param done Set to the amount of chars read
+ * @return 0 or the errno
+ */
+static int read_full (int fd, unsigned char *buf, size_t len, size_t *done);
+
+/**
+ * @brief Repeats write(2) until every char is written
+ * @param fd The file descriptor
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @return 0 or the errno
+ */
+static int write_full (int fd, const char *buf, size_t len);
+
+/**
+ * @brief Sets up an io_uring
+ * @param ring A reference to the ring
+ * @return 0 on success, -1 if the kernel has no (usable) io_uring
+ */
+static int ring_init (struct s_ring *ring);
+
+/**
+ * @brief Submits one read or write request
+ * @param ring A reference to the ring
+ * @param write 1 for a write, 0 for a read
+ * @param fd The file descriptor
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @param offset The offset in the file, -1 for pipes
+ * @param user_data Returned with the completion
+ * @return 0 or the errno
+ */
+static int ring_submit (struct s_ring *ring, int write, int fd, void *buf, size_t len, off_t offset,
+	uint64_t user_data);
+
+/**
+ * @brief Waits for at least one completion and hands every completion to complete()
+ * @param io A reference to the pipeline that owns the ring
+ * @return 0 or the errno
+ */
+static int ring_wait (struct ringio *io);
+
+/**
+ * @brief Unmaps and closes an io_uring
+ * @param ring A reference to the ring
+ */
+static void ring_free (struct s_ring *ring);
+
+/* === Implementations === */
+
+int ringio_init (struct ringio **io, int in_fd, int out_fd, size_t buf_size)
+{
+	const char *mode = getenv ("MYCOMPRESS_IO");
+	struct ringio *p;
+	int i, err;
+
+	if ((p = calloc (1, sizeof(*p))) == NULL)
+	{
+		return ENOMEM;
+	}
+	p->in_fd = -1;
+	p->out_fd = out_fd;
+	p->buf_size = buf_size;
+	p->ring.fd = -1;
+
+	if ((mode == NULL || strcmp (mode, "sync") != 0) && ring_init (&p->ring) == 0)
+	{
+		p->use_ring = 1;
+	}
+
+	/* Without a ring the output is not copied */
+	for (i = 0; p->use_ring && i < RINGIO_WRITE_BUFS; i++)
+	{
+		if ((p->writes[i].data = malloc (WRITE_BUF_SIZE)) == NULL)
+		{
+			ringio_free (p);
+			return ENOMEM;
+		}
+	}
+
+	/* Offsets start at the current position, lseek(2) fails on pipes */
+	p->in_offset = -1;
+	p->out_offset = lseek (out_fd, 0, SEEK_CUR);
+
+	if (in_fd != -1 && (err = ringio_input (p, in_fd)) != 0)
+	{
+		ringio_free (p);
+		return err;
+	}
+
+	*io = p;
+	return 0;
+}
+
+
+int ringio_input (struct ringio *io, int in_fd)
+{
+	int i, err;
+
+	/* Reads behind the end of the previous input may still be in flight */
+	for (i = 0; i < RINGIO_READ_BUFS; i++)
+	{
+		while (io->reads[i].state == BUF_BUSY)
+		{
+			if ((err = wait_requests (io, 0)) != 0)
+			{
+				return err;
+			}
+		}
+	}
+
+	/* Without a ring a single input buffer is enough */
+	for (i = 0; i < (io->use_ring ? RINGIO_READ_BUFS : 1); i++)
+	{
+		if (io->reads[i].data == NULL && (io->reads[i].data = malloc (io->buf_size)) == NULL)
+		{
+			return io->error[0] = ENOMEM;
+		}
+		io->reads[i].state = BUF_FREE;
+		io->reads[i].len = 0;
+	}
+
+	io->in_fd = in_fd;
+	io->in_offset = lseek (in_fd, 0, SEEK_CUR);
+	io->in_end = io->in_offset;
+	io->read_next = 0;
+	io->read_fill = 0;
+	io->eof = 0;
+
+	return 0;
+}
+
+
+int ringio_read (struct ringio *io, const unsigned char **buf, size_t *len)
+{
+	struct s_buf *b;
+	int err;
+
+	if (io->error[0] != 0)
+	{
+		return io->error[0];
+	}
+
+	if (!io->use_ring)
+	{
+		if ((err = read_full (io->in_fd, io->reads[0].data, io->buf_size, len)) != 0)
+		{
+			return io->error[0] = err;
+		}
+		*buf = io->reads[0].data;
+		return 0;
+	}
+
+	/* The buffer that was handed out last can be read into again */
+	b = &io->reads[(io->read_next + RINGIO_READ_BUFS - 1) % RINGIO_READ_BUFS];
+	if (b->state == BUF_HANDED)
+	{
+		b->state = BUF_FREE;
+	}
+	(void) start_reads (io);
+
+	b = &io->reads[io->read_next];
+	while (b->state != BUF_READY)
+	{
+		/* No read was started since the input ended before this buffer */
+		if (b->state == BUF_FREE && io->eof)
+		{
+			*len = 0;
+			end_input (io);
+			return 0;
+		}
+		if ((err = wait_requests (io, 0)) != 0)
+		{
+			return err;
+		}
+	}
+
+	b->state = BUF_HANDED;
+	io->read_next = (io->read_next + 1) % RINGIO_READ_BUFS;
+	*buf = b->data;
+	*len = b->len;
+	if (b->offset != -1 && b->len > 0)
+	{
+		io->in_end = b->offset + (off_t) b->len;
+	}
+	if (b->len == 0)
+	{
+		end_input (io);
+	}
+
+	return 0;
+}
+
+
+int ringio_write (struct ringio *io, const char *buf, size_t len)
+{
+	int err;
+
+	if (io->error[1] != 0)
+	{
+		return io->error[1];
+	}
+
+	if (!io->use_ring)
+	{
+		return io->error[1] = write_full (io->out_fd, buf, len);
+	}
+
+	while (len > 0)
+	{
+		struct s_buf *b = &io->writes[io->write_cur];
+		size_t n;
+
+		while (b->state != BUF_FREE)
+		{
+			if ((err = wait_requests (io, 1)) != 0)
+			{
+				return err;
+			}
+		}
+
+		n = WRITE_BUF_SIZE - b->len < len ? WRITE_BUF_SIZE - b->len : len;
+		(void) memcpy (b->data + b->len, buf, n);
+		b->len += n;
+		buf += n;
+		len -= n;
+
+		if (b->len == WRITE_BUF_SIZE)
+		{
+			(void) queue_write (io, b);
+		}
+	}
+
+	return io->error[1];
+}
+
+
+int ringio_flush (struct ringio *io)
+{
+	int err;
+
+	if (io->error[1] != 0 || !io->use_ring)
+	{
+		return io->error[1];
+	}
+
+	if (io->writes[io->write_cur].len > 0)
+	{
+		(void) queue_write (io, &io->writes[io->write_cur]);
+	}
+
+	for (int i = 0; i < RINGIO_WRITE_BUFS; i++)
+	{
+		while (io->writes[i].state != BUF_FREE)
+		{
+			if ((err = wait_requests (io, 1)) != 0)
+			{
+				return err;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+void ringio_free (struct ringio *io)
+{
+	int i;
+
+	if (io == NULL)
+	{
+		return;
+	}
+
+	/* The kernel may still write into the buffers until the requests are completed */
+	while (io->use_ring && io->ring.in_flight > 0)
+	{
+		if (ring_wait (io) != 0)
+		{
+			/* The buffers are leaked rather than handed out while they are in use */
+			ring_free (&io->ring);
+			free (io);
+			return;
+		}
+	}
+	if (io->use_ring)
+	{
+		ring_free (&io->ring);
+	}
+
+	for (i = 0; i < RINGIO_READ_BUFS; i++)
+	{
+		free (io->reads[i].data);
+	}
+	for (i = 0; i < RINGIO_WRITE_BUFS; i++)
+	{
+		free (io->writes[i].data);
+	}
+	free (io);
+}
+
+
+static void start_reads (struct ringio *io)
+{
+	/* Reads are started in ring order, so on a pipe only the buffer before read_fill can be busy */
+	while (!io->eof && io->error[0] == 0 && io->reads[io->read_fill].state == BUF_FREE && (io->in_offset != -1
+		|| io->reads[(io->read_fill + RINGIO_READ_BUFS - 1) % RINGIO_READ_BUFS].state != BUF_BUSY))
+	{
+		struct s_buf *b = &io->reads[io->read_fill];
+
+		b->len = 0;
+		b->offset = io->in_offset;
+		if (io->in_offset != -1)
+		{
+			io->in_offset += (off_t) io->buf_size;
+		}
+		io->read_fill = (io->read_fill + 1) % RINGIO_READ_BUFS;
+
+		(void) submit (io, b, 0);
+	}
+}
+
+
+static void end_input (struct ringio *io)
+{
+	if (io->in_end != -1)
+	{
+		(void) lseek (io->in_fd, io->in_end, SEEK_SET);
+	}
+}
+
+
+static void queue_write (struct ringio *io, struct s_buf *b)
+{
+	b->done = 0;
+	b->offset = io->out_offset;
+	if (io->out_offset != -1)
+	{
+		io->out_offset += (off_t) b->len;
+	}
+	io->write_cur = (io->write_cur + 1) % RINGIO_WRITE_BUFS;
+
+	/* A pipe gets the next write once the one before it is completed */
+	if (io->out_offset != -1 || io->writes[io->write_next].state != BUF_BUSY)
+	{
+		(void) submit (io, b, 1);
+	}
+	else
+	{
+		b->state = BUF_QUEUED;
+	}
+}
+
+
+static void submit (struct ringio *io, struct s_buf *b, int write)
+{
+	size_t index = (size_t) (b - (write ? io->writes : io->reads));
+	size_t done = write ? b->done : b->len;
+	size_t len = write ? b->len : io->buf_size;
+	int err;
+
+	b->state = BUF_BUSY;
+	err = ring_submit (&io->ring, write, write ? io->out_fd : io->in_fd, b->data + done, len - done,
+		b->offset != -1 ? b->offset + (off_t) done : -1, write ? USER_WRITE | index : index);
+	if (err != 0 && io->error[write] == 0)
+	{
+		io->error[write] = err;
+	}
+}
+
+
+static int wait_requests (struct ringio *io, int write)
+{
+	int err;
+
+	if (io->error[write] != 0)
+	{
+		return io->error[write];
+	}
+
+	/* Without the ring neither side can go on */
+	if ((err = ring_wait (io)) != 0)
+	{
+		io->error[0] = io->error[0] != 0 ? io->error[0] : err;
+		io->error[1] = io->error[1] != 0 ? io->error[1] : err;
+	}
+
+	return io->error[write];
+}
+
+
+static void complete (struct ringio *io, uint64_t user_data, int res)
+{
+	int write = (user_data & USER_WRITE) != 0;
+	struct s_buf *b = write ? &io->writes[user_data & ~(uint64_t) USER_WRITE] : &io->reads[user_data];
+
+	if (res == -EINTR || res == -EAGAIN)
+	{
+		(void) submit (io, b, write);
+		return;
+	}
+	if (res < 0 || (write && res == 0))
+	{
+		b->state = BUF_FREE;
+		if (io->error[write] == 0)
+		{
+			io->error[write] = res < 0 ? -res : EIO;
+		}
+		return;
+	}
+
+	if (!write)
+	{
+		b->len += (size_t) res;
+		if (res == 0 || b->len == io->buf_size)
+		{
+			b->state = BUF_READY;
+			io->eof |= res == 0;
+			(void) start_reads (io);
+		}
+		else
+		{
+			(void) submit (io, b, 0);
+		}
+		return;
+	}
+
+	b->done += (size_t) res;
+	if (b->done < b->len)
+	{
+		(void) submit (io, b, 1);
+		return;
+	}
+
+	b->state = BUF_FREE;
+	b->len = 0;
+
+	/* Pipes: the buffers are written one after the other */
+	if (io->out_offset == -1)
+	{
+		io->write_next = (io->write_next + 1) % RINGIO_WRITE_BUFS;
+		if (io->writes[io->write_next].state == BUF_QUEUED)
+		{
+			(void) submit (io, &io->writes[io->write_next], 1);
+		}
+	}
+}
+
+
+static int read_full (int fd, unsigned char *buf, size_t len, size_t *done)
+{
+	*done = 0;
+
+	while (*done < len)
+	{
+		ssize_t n = read (fd, buf + *done, len - *done);
+
+		if (n == 0)
+		{
+			break;
+		}
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+		*done += (size_t) n;
+	}
+
+	return 0;
+}
+
+
+static int write_full (int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write (fd, buf, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return errno;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+/* === io_uring === */
+
+#ifdef HAVE_IO_URING
+
+static int ring_init (struct s_ring *ring)
+{
+	struct io_uring_params params;
+	long fd;
+
+	(void) memset (&params, 0, sizeof(params));
+	if ((fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &params)) < 0)
+	{
+		return -1;
+	}
+	ring->fd = (int) fd;
+
+	/* IORING_OP_READ and IORING_OP_WRITE are older than IORING_FEAT_FAST_POLL */
+	if ((params.features & IORING_FEAT_FAST_POLL) == 0)
+	{
+		(void) close (ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+
+	ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* With IORING_FEAT_SINGLE_MMAP both queues are in the same mapping */
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_map_len > ring->sq_map_len)
+		{
+			ring->sq_map_len = ring->cq_map_len;
+		}
+		ring->cq_map_len = ring->sq_map_len;
+	}
+
+	ring->sq_map = mmap (NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_SQ_RING);
+	ring->cq_map = params.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_map
+		: mmap (NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_CQ_RING);
+	ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_SQES);
+	if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		ring_free (ring);
+		return -1;
+	}
+
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_map + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_map + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_map + params.sq_off.array);
+	ring->cq_head = (unsigned *) ((char *) ring->cq_map + params.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_map + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_map + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_map + params.cq_off.cqes);
+	ring->in_flight = 0;
+
+	return 0;
+}
+
+
+static int ring_submit (struct s_ring *ring, int write, int fd, void *buf, size_t len, off_t offset,
+	uint64_t user_data)
+{
+	unsigned tail = *ring->sq_tail, index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	/* Every buffer has at most one request in flight, so the queue is never full */
+	(void) memset (sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) buf;
+	sqe->len = (uint32_t) len;
+	sqe->off = (uint64_t) offset;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+
+	/* The kernel must see the entry before the new tail */
+	__atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall (__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+	{
+		if (errno != EINTR && errno != EAGAIN)
+		{
+			return errno;
+		}
+	}
+	ring->in_flight++;
+
+	return 0;
+}
+
+
+static int ring_wait (struct ringio *io)
+{
+	struct s_ring *ring = &io->ring;
+	unsigned head = *ring->cq_head;
+
+	while (head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		if (syscall (__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+		{
+			return errno;
+		}
+	}
+
+	/* complete() may submit new requests, but it never waits, so the completions can be handled in place */
+	while (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		uint64_t user_data = cqe->user_data;
+		int res = cqe->res;
+
+		__atomic_store_n (ring->cq_head, ++head, __ATOMIC_RELEASE);
+		ring->in_flight--;
+		(void) complete (io, user_data, res);
+	}
+
+	return 0;
+}
+
+
+static void ring_free (struct s_ring *ring)
+{
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+	{
+		(void) munmap (ring->sqes, ring->sqes_len);
+	}
+	if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+	{
+		(void) munmap (ring->cq_map, ring->cq_map_len);
+	}
+	if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+	{
+		(void) munmap (ring->sq_map, ring->sq_map_len);
+	}
+	(void) close (ring->fd);
+	ring->fd = -1;
+}
+
+#else
+
+static int ring_init (struct s_ring *ring)
+{
+	(void) ring;
+	return -1;
+}
+
+
+static int ring_submit (struct s_ring *ring, int write, int fd, void *buf, size_t len, off_t offset,
+	uint64_t user_data)
+{
+	(void) ring;
+	(void) write;
+	(void) fd;
+	(void) buf;
+	(void) len;
+	(void) offset;
+	(void) user_data;
+	return ENOSYS;
+}
+
+
+static int ring_wait (struct ringio *io)
+{
+	(void) io;
+	return ENOSYS;
+}
+
+
+static void ring_free (struct s_ring *ring)
+{
+	(void) ring;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file ringio.h
+ * @author Constantin Schieber, e1228774
+ * @brief Pipelined input and output of mycompress
+ * @details While the caller compresses one input buffer the reads of the next RINGIO_READ_BUFS - 1 buffers and the
+ * writes of the output that was handed over before are in flight. The requests go through an io_uring. If the
+ * kernel has none, or the environment variable MYCOMPRESS_IO is set to sync, every call blocks on plain read(2)
+ * and write(2) instead. The chars come out and go in in the order of the streams either way.
+ *
+ * Every function returns 0 on success or the errno of the failed operation. The first error of the input sticks to
+ * ringio_read(), the first error of the output to ringio_write() and ringio_flush().
+ * @date 17.10.2026
+ */
+
+#ifndef RINGIO_H
+#define RINGIO_H
+
+#include <stddef.h>
+
+/* Input buffers, one is handed out, the others are read ahead */
+#define RINGIO_READ_BUFS (3)
+
+/* Output buffers, one collects chars, the others are written */
+#define RINGIO_WRITE_BUFS (4)
+
+/* State of one pipeline, opaque */
+struct ringio;
+
+/**
+ * @brief Creates a pipeline
+ * @param io Set to the new pipeline
+ * @param in_fd The input file descriptor, -1 if nothing is read or the input is set later with ringio_input()
+ * @param out_fd The output file descriptor
+ * @param buf_size The size of an input buffer, every read fills one unless the input ends
+ * @return 0 or the errno
+ */
+int ringio_init (struct ringio **io, int in_fd, int out_fd, size_t buf_size);
+
+/**
+ * @brief Switches to another input
+ * @details Reads of the previous input that are still in flight are waited for, so it should have ended. The
+ * input buffers are allocated with the first input.
+ * @param io A reference to the pipeline
+ * @param in_fd The input file descriptor
+ * @return 0 or the errno
+ */
+int ringio_input (struct ringio *io, int in_fd);
+
+/**
+ * @brief Hands out the next input buffer
+ * @details The buffer stays valid until the next call, it is read again afterwards.
+ * @param io A reference to the pipeline
+ * @param buf Set to a reference to the chars
+ * @param len Set to the amount of chars, buf_size unless the input ends, 0 at the end
+ * @return 0 or the errno
+ */
+int ringio_read (struct ringio *io, const unsigned char **buf, size_t *len);
+
+/**
+ * @brief Appends chars to the output
+ * @details The chars are copied, the write may still be in flight when the function returns.
+ * @param io A reference to the pipeline
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @return 0 or the errno
+ */
+int ringio_write (struct ringio *io, const char *buf, size_t len);
+
+/**
+ * @brief Writes everything that is left and waits until it is written
+ * @param io A reference to the pipeline
+ * @return 0 or the errno
+ */
+int ringio_flush (struct ringio *io);
+
+/**
+ * @brief Releases a pipeline, requests that are still in flight are waited for
+ * @param io A reference to the pipeline, may be NULL
+ */
+void ringio_free (struct ringio *io);
+
+#endif
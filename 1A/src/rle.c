@@ -0,0 +1,1284 @@
+/**
+ * @file rle.c
+ * @author Constantin Schieber, e1228774
+ * @brief Streaming run length compression, see rle.h
+ * @details The legacy format keeps the last run of an update open since it may continue in the next one. The binary
+ * format keeps the chars of a block that is not full yet in pending, only the last block of a stream may be short.
+ * The mode of every block is chosen by a sample of it: blocks with too few runs are stored as they are, with level 1
+ * the tokens are Huffman coded if the sample says that pays off. A block whose payload turns out to be longer than
+ * its chars is stored nevertheless. With the checksum option every block ends with the CRC-32C of its chars.
+ *
+ * With more than one thread every update is cut into one chunk per thread. The chunks are compressed concurrently and
+ * stitched together in order, runs that cross the border of two chunks are merged while stitching, so the output
+ * does not depend on the amount of threads.
+ *
+ * The run length kernel is chosen once per process by the CPU features, the environment variable MYCOMPRESS_SIMD
+ * (scalar, sse2, avx2, avx512) can force a lower variant.
+ * @date 17.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "clones.h"
+#include "comp_format.h"
+#include "crc32c.h"
+#include "huff.h"
+#include "rle.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+/* === Constants === */
+
+/* Size of the output buffer, it is handed to the sink once it is (nearly) full. It has to hold at least one encoded
+ * block of the binary format.
+ */
+#define OUT_BUF_SIZE (2 << 20)
+
+/* Smallest part of an update one thread compresses */
+#define MIN_CHUNK_SIZE (64 << 10)
+
+/* Sampling of the blocks of the binary format: SAMPLE_COUNT windows of SAMPLE_LEN chars, spread evenly over the
+ * block. Shorter blocks are not sampled, every mode is tried on them.
+ */
+#define SAMPLE_COUNT (16)
+#define SAMPLE_LEN (1024)
+#define SAMPLE_MIN_BLOCK (64 << 10)
+
+/* Stored blocks are copied and checksummed in pieces of CRC_STEP chars */
+#define CRC_STEP (16 << 10)
+
+/* A mode has to save at least 1 / SAMPLE_GAIN of the sample over the next simpler one to be chosen */
+#define SAMPLE_GAIN (32)
+
+/* Two digit lookup table for the count encoder, "00" "01" ... "99" */
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* === Structures === */
+
+/* Block index of the binary format, pairs of input offset and output offset */
+struct s_index
+{
+	uint64_t *entries;
+	size_t count;
+	size_t size;
+};
+
+/* The run that is not finished yet and the buffered output */
+struct s_rle_state
+{
+	const struct rle_options *options;
+	rle_sink sink;			/*< NULL for the states of chunks, their buffer never gets full */
+	void *opaque;
+	int prev_x;
+	uint64_t count_x;
+	char *out_buf;
+	size_t out_size;
+	size_t out_pos;
+	uint64_t out_length;		/*< Chars handed to the sink so far */
+	uint64_t raw_pos;		/*< Binary format: offset of the next block in the input */
+	struct s_index *index;		/*< Binary format: block index that is written behind the stream, or NULL */
+	unsigned char *tokens;		/*< Binary format with level 1: the tokens of the block that is encoded */
+	int error;			/*< The first error, RLE_OK if there is none */
+};
+
+/* A part of an update that gets compressed by its own thread. The first and the last run are kept apart from the
+ * encoded runs in between since they may continue in the neighbouring chunks.
+ */
+struct s_chunk
+{
+	const unsigned char *buf;
+	size_t len;
+	int first_x;
+	size_t first_count;
+	int single_run;		/*< The whole chunk is the first run, the state holds no other run */
+	struct s_rle_state state;	/*< Encoded runs between the first and the last one, the last one is still open */
+	struct s_index index;		/*< Binary format: index entries of the chunk, relative to its output */
+};
+
+struct rle_context
+{
+	struct rle_options options;
+	struct s_rle_state state;
+	struct s_index index;
+	unsigned char *pending;		/*< Binary format: chars of the block that is not full yet */
+	size_t pending_len;
+	uint64_t in_count;
+	int finished;
+};
+
+/* === Global Variables === */
+
+/* Run length kernel, chosen by select_run_length() */
+static size_t (*run_length) (const unsigned char *buf, size_t len);
+
+static pthread_once_t run_length_once = PTHREAD_ONCE_INIT;
+
+/* === Prototypes === */
+
+/**
+ * @brief Starts an empty stream, the header of the binary format is buffered immediately
+ * @param ctx A reference to the context, its buffers are kept
+ */
+static void start_stream (struct rle_context *ctx);
+
+/**
+ * @brief Compresses a part of the input with the format and amount of threads of the state
+ * @param state A reference to the state of the compression
+ * @param buf A reference to the input
+ * @param len The amount of chars, a multiple of COMP_BLOCK_SIZE unless it is the end of a binary format stream
+ */
+static void compress_input (struct s_rle_state *state, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Compresses a part of the input into runs of the legacy format
+ * @details The run at the end stays open in the state since it may continue in the next part. Multiversioned, see
+ * clones.h.
+ * @param state A reference to the state of the compression
+ * @param buf A reference to the input
+ * @param len The amount of chars
+ */
+static void compress_block (struct s_rle_state *state, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Compresses a part of the input into blocks of the binary format
+ * @details Every COMP_BLOCK_SIZE chars start a new block, runs are cut at the border of the blocks.
+ * @param state A reference to the state of the compression
+ * @param buf A reference to the input
+ * @param len The amount of chars
+ */
+static void compress_blocks (struct s_rle_state *state, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Compresses a part of the input with one thread per chunk
+ * @param state A reference to the state of the compression
+ * @param buf A reference to the input
+ * @param len The amount of chars
+ */
+static void compress_parallel (struct s_rle_state *state, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Thread routine of compress_parallel(), compresses one chunk
+ * @param arg A reference to the struct s_chunk
+ * @return NULL
+ */
+static void *compress_chunk (void *arg);
+
+/**
+ * @brief Hands the output buffer of the state to its sink
+ * @param state A reference to the state of the compression
+ */
+static void flush_output (struct s_rle_state *state);
+
+/**
+ * @brief Appends already encoded chars to the output of the state
+ * @param state A reference to the state of the compression
+ * @param buf A reference to the encoded chars
+ * @param len The amount of chars
+ */
+static void append_output (struct s_rle_state *state, const char *buf, size_t len);
+
+/**
+ * @brief Appends the open run of the state to its output buffer, flushes the buffer first if it is full
+ * @details Runs longer than RLE_RUN_COUNT_MAX are appended as several runs of the same char.
+ * @param state A reference to the state of the compression
+ */
+static void emit_run (struct s_rle_state *state);
+
+/**
+ * @brief Adds an entry to a block index
+ * @param state A reference to the state the index belongs to, gets RLE_ERROR_MEMORY if the index can't grow
+ * @param index A reference to the index
+ * @param raw The offset of the block in the input
+ * @param comp The offset of the block in the compressed output
+ */
+static void index_add (struct s_rle_state *state, struct s_index *index, uint64_t raw, uint64_t comp);
+
+/**
+ * @brief Appends the block index and the trailer to the output
+ * @param state A reference to the state of the compression, the end of the stream has to be written already
+ */
+static void write_index (struct s_rle_state *state);
+
+/**
+ * @brief Encodes an unsigned 64 bit integer in little endian
+ * @param dst A reference to the output buffer, at least 8 chars have to be free
+ * @param v The value
+ */
+static void encode_u64 (char *dst, uint64_t v);
+
+/**
+ * @brief Encodes one block of the binary format, including its header
+ * @param dst A reference to the output buffer, at least COMP_BLOCK_BOUND(len) chars have to be free
+ * @param tokens A reference to a buffer of COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE) chars for Huffman coding the
+ * tokens, NULL to never Huffman code them
+ * @param checksum Whether the CRC of the chars follows the payload
+ * @param buf A reference to the chars of the block
+ * @param len The amount of chars in the block, at most COMP_BLOCK_SIZE
+ * @return The amount of chars written to dst
+ */
+static size_t encode_block (char *dst, unsigned char *tokens, int checksum, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Chooses the mode of a block by compressing a sample of it
+ * @param huff Whether COMP_MODE_HUFF may be chosen
+ * @param buf A reference to the chars of the block
+ * @param len The amount of chars in the block
+ * @return COMP_MODE_STORED, COMP_MODE_RLE or COMP_MODE_HUFF
+ */
+static int estimate_mode (int huff, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Encodes chars as literal and repeat tokens of the binary format
+ * @details Runs of three and more chars become repeat tokens, so do runs of two chars that don't interrupt a literal.
+ * Everything else is collected into literals of up to COMP_LITERAL_MAX chars. Multiversioned, see clones.h.
+ * @param dst A reference to the output buffer, at least COMP_PAYLOAD_BOUND(len) chars have to be free
+ * @param buf A reference to the chars
+ * @param len The amount of chars
+ * @return The amount of chars written to dst
+ */
+static size_t encode_tokens (char *dst, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Encodes an unsigned LEB128 varint
+ * @param dst A reference to the output buffer, at least COMP_VARINT_MAX chars have to be free
+ * @param v The value
+ * @return The amount of chars written to dst
+ */
+static size_t encode_varint (char *dst, uint64_t v);
+
+/**
+ * @brief Encodes a run as the char followed by its decimal count
+ * @details The count is formatted two digits at a time with the digit_pairs table.
+ * @param dst A reference to the output buffer, at least RLE_RUN_MAX_LEN chars have to be free
+ * @param c The char of the run
+ * @param count The amount of occurences of c
+ * @return The amount of chars written to dst
+ */
+static size_t encode_run (char *dst, int c, uint32_t count);
+
+/**
+ * @brief Returns the length of the run of equal chars at the start of a buffer
+ * @details Portable version, compares every char with its predecessor.
+ * @param buf A reference to the first char of the run
+ * @param len The amount of chars in the buffer, at least 1
+ * @return The amount of consecutive chars equal to buf[0], between 1 and len
+ */
+static size_t run_length_scalar (const unsigned char *buf, size_t len);
+
+#ifdef HAVE_X86_SIMD
+/**
+ * @brief SSE2, AVX2 and AVX-512 versions of run_length_scalar()
+ * @details Compare 16, 32 or 64 chars with the same chars shifted by one and jump to the first mismatch with the
+ * movemask / tzcnt of the comparison.
+ */
+static size_t run_length_sse2 (const unsigned char *buf, size_t len);
+static size_t run_length_avx2 (const unsigned char *buf, size_t len);
+static size_t run_length_avx512 (const unsigned char *buf, size_t len);
+#endif
+
+/**
+ * @brief Sets run_length to the fastest kernel the CPU supports
+ */
+static void select_run_length (void);
+
+/* === Interface === */
+
+int rle_init (struct rle_context **ctx, const struct rle_options *options, rle_sink sink, void *opaque)
+{
+	static const struct rle_options defaults = { RLE_FORMAT_LEGACY, 1, 0, 0, 0 };
+	struct rle_context *c;
+
+	if (ctx == NULL || sink == NULL)
+	{
+		return RLE_ERROR_ARGUMENT;
+	}
+	*ctx = NULL;
+	if (options == NULL)
+	{
+		options = &defaults;
+	}
+	if ((options->format != RLE_FORMAT_LEGACY && options->format != RLE_FORMAT_BINARY)
+		|| options->threads < 1 || options->threads > RLE_MAX_THREADS
+		|| options->level < 0 || options->level > RLE_LEVEL_MAX
+		|| (options->level > 0 && options->format != RLE_FORMAT_BINARY)
+		|| options->checksum < 0 || options->checksum > 1
+		|| (options->checksum > 0 && options->format != RLE_FORMAT_BINARY)
+		|| (options->index_interval != 0
+			&& (options->format != RLE_FORMAT_BINARY || options->index_interval % COMP_BLOCK_SIZE != 0)))
+	{
+		return RLE_ERROR_ARGUMENT;
+	}
+
+	(void) pthread_once (&run_length_once, select_run_length);
+
+	if ((c = calloc (1, sizeof(*c))) == NULL)
+	{
+		return RLE_ERROR_MEMORY;
+	}
+	c->options = *options;
+	c->state.options = &c->options;
+	c->state.sink = sink;
+	c->state.opaque = opaque;
+	c->state.out_size = OUT_BUF_SIZE;
+	c->state.index = options->index_interval != 0 ? &c->index : NULL;
+	if ((c->state.out_buf = malloc (OUT_BUF_SIZE)) == NULL
+		|| (options->level > 0 && (c->state.tokens = malloc (COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE))) == NULL))
+	{
+		free (c->state.out_buf);
+		free (c);
+		return RLE_ERROR_MEMORY;
+	}
+
+	(void) start_stream (c);
+
+	*ctx = c;
+	return RLE_OK;
+}
+
+
+int rle_reset (struct rle_context *ctx)
+{
+	if (ctx->state.error != RLE_OK)
+	{
+		return ctx->state.error;
+	}
+	(void) start_stream (ctx);
+
+	return RLE_OK;
+}
+
+
+int rle_update (struct rle_context *ctx, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	size_t full;
+
+	if (ctx->state.error != RLE_OK)
+	{
+		return ctx->state.error;
+	}
+	if (ctx->finished)
+	{
+		return RLE_ERROR_FINISHED;
+	}
+	ctx->in_count += len;
+
+	if (ctx->options.format == RLE_FORMAT_LEGACY)
+	{
+		(void) compress_input (&ctx->state, p, len);
+		return ctx->state.error;
+	}
+
+	/* Only the last block may be short, so a partial block waits until the next update completes it */
+	if (ctx->pending_len > 0)
+	{
+		size_t n = COMP_BLOCK_SIZE - ctx->pending_len < len ? COMP_BLOCK_SIZE - ctx->pending_len : len;
+
+		(void) memcpy (ctx->pending + ctx->pending_len, p, n);
+		ctx->pending_len += n;
+		p += n;
+		len -= n;
+		if (ctx->pending_len < COMP_BLOCK_SIZE)
+		{
+			return RLE_OK;
+		}
+		(void) compress_input (&ctx->state, ctx->pending, COMP_BLOCK_SIZE);
+		ctx->pending_len = 0;
+	}
+
+	/* Full blocks are compressed straight from the buffer of the caller */
+	full = len / COMP_BLOCK_SIZE * COMP_BLOCK_SIZE;
+	if (full > 0)
+	{
+		(void) compress_input (&ctx->state, p, full);
+	}
+
+	if (len > full)
+	{
+		if (ctx->pending == NULL && (ctx->pending = malloc (COMP_BLOCK_SIZE)) == NULL)
+		{
+			ctx->state.error = RLE_ERROR_MEMORY;
+			return ctx->state.error;
+		}
+		(void) memcpy (ctx->pending, p + full, len - full);
+		ctx->pending_len = len - full;
+	}
+
+	return ctx->state.error;
+}
+
+
+int rle_finish (struct rle_context *ctx)
+{
+	const char end = COMP_MODE_END;
+
+	if (ctx->state.error != RLE_OK)
+	{
+		return ctx->state.error;
+	}
+	if (ctx->finished)
+	{
+		return RLE_ERROR_FINISHED;
+	}
+	ctx->finished = 1;
+
+	if (ctx->options.format == RLE_FORMAT_BINARY)
+	{
+		if (ctx->pending_len > 0)
+		{
+			(void) compress_input (&ctx->state, ctx->pending, ctx->pending_len);
+			ctx->pending_len = 0;
+		}
+		(void) append_output (&ctx->state, &end, 1);
+		if (ctx->state.index != NULL)
+		{
+			(void) write_index (&ctx->state);
+		}
+	}
+	else if (ctx->state.count_x > 0)
+	{
+		/* Empty input gives empty output */
+		(void) emit_run (&ctx->state);
+	}
+
+	(void) flush_output (&ctx->state);
+
+	return ctx->state.error;
+}
+
+
+void rle_free (struct rle_context *ctx)
+{
+	if (ctx == NULL)
+	{
+		return;
+	}
+	free (ctx->state.out_buf);
+	free (ctx->state.tokens);
+	free (ctx->index.entries);
+	free (ctx->pending);
+	free (ctx);
+}
+
+
+uint64_t rle_in_count (const struct rle_context *ctx)
+{
+	return ctx->in_count;
+}
+
+
+uint64_t rle_out_count (const struct rle_context *ctx)
+{
+	return ctx->state.out_length + ctx->state.out_pos;
+}
+
+
+const char *rle_strerror (int error)
+{
+	switch (error)
+	{
+		case RLE_OK:
+			return "Success";
+		case RLE_ERROR_ARGUMENT:
+			return "Invalid argument";
+		case RLE_ERROR_MEMORY:
+			return "Out of memory";
+		case RLE_ERROR_SINK:
+			return "Output failed";
+		case RLE_ERROR_FINISHED:
+			return "Compression finished already";
+		default:
+			return "Unknown error";
+	}
+}
+
+
+size_t rle_encode_run (char *dst, int c, uint32_t count)
+{
+	return encode_run (dst, c, count);
+}
+
+/* === Compression === */
+
+static void start_stream (struct rle_context *ctx)
+{
+	ctx->state.prev_x = 0;
+	ctx->state.count_x = 0;
+	ctx->state.out_pos = 0;
+	ctx->state.out_length = 0;
+	ctx->state.raw_pos = 0;
+	ctx->index.count = 0;
+	ctx->pending_len = 0;
+	ctx->in_count = 0;
+	ctx->finished = 0;
+
+	if (ctx->options.format == RLE_FORMAT_BINARY)
+	{
+		(void) memcpy (ctx->state.out_buf, COMP_MAGIC, COMP_MAGIC_LEN);
+		ctx->state.out_buf[COMP_MAGIC_LEN] = COMP_VERSION;
+		ctx->state.out_buf[COMP_MAGIC_LEN + 1] = (char) ((ctx->options.index_interval != 0 ? COMP_FLAG_INDEX : 0)
+			| (ctx->options.checksum != 0 ? COMP_FLAG_CRC : 0));
+		ctx->state.out_pos = COMP_HEADER_LEN;
+	}
+}
+
+
+static void compress_input (struct s_rle_state *state, const unsigned char *buf, size_t len)
+{
+	if (state->options->threads > 1)
+	{
+		(void) compress_parallel (state, buf, len);
+	}
+	else if (state->options->format == RLE_FORMAT_BINARY)
+	{
+		(void) compress_blocks (state, buf, len);
+	}
+	else
+	{
+		(void) compress_block (state, buf, len);
+	}
+}
+
+
+HOT_CLONES
+static void compress_block (struct s_rle_state *state, const unsigned char *buf, size_t len)
+{
+	size_t i = 0;
+
+	/* Measure how long the runs of the same char are. Every finished run is appended to the output buffer. */
+
+	/* The run from the previous part continues */
+	if (state->count_x > 0 && len > 0 && buf[0] == state->prev_x)
+	{
+		i = run_length (buf, len);
+		state->count_x += i;
+	}
+
+	while (i < len)
+	{
+		size_t run;
+
+		if (state->count_x > 0)
+		{
+			(void) emit_run (state);
+		}
+
+		/* Most runs of text are a single char, they are found here without the call of the kernel */
+		run = i + 1 < len && buf[i + 1] != buf[i] ? 1 : run_length (buf + i, len - i);
+		state->prev_x = buf[i];
+		state->count_x = run;
+		i += run;
+	}
+}
+
+
+static void compress_blocks (struct s_rle_state *state, const unsigned char *buf, size_t len)
+{
+	while (len > 0 && state->error == RLE_OK)
+	{
+		size_t block = len < COMP_BLOCK_SIZE ? len : COMP_BLOCK_SIZE;
+
+		if (state->out_pos + COMP_BLOCK_BOUND(block) > state->out_size)
+		{
+			(void) flush_output (state);
+		}
+
+		if (state->index != NULL && state->raw_pos % state->options->index_interval == 0)
+		{
+			(void) index_add (state, state->index, state->raw_pos, state->out_length + state->out_pos);
+		}
+		state->out_pos += encode_block (state->out_buf + state->out_pos, state->tokens, state->options->checksum, buf,
+			block);
+		state->raw_pos += block;
+
+		buf += block;
+		len -= block;
+	}
+}
+
+
+static void compress_parallel (struct s_rle_state *state, const unsigned char *buf, size_t len)
+{
+	struct s_chunk chunks[RLE_MAX_THREADS];
+	pthread_t tids[RLE_MAX_THREADS];
+	int started[RLE_MAX_THREADS];
+	int threads = state->options->threads;
+
+	while (len > 0 && state->error == RLE_OK)
+	{
+		/* Spread the part over the threads, but don't hand out tiny or huge chunks */
+		size_t chunk_len = (len + (size_t) threads - 1) / (size_t) threads;
+		size_t done = 0;
+		int nchunks = 0, i;
+
+		if (chunk_len < MIN_CHUNK_SIZE)
+		{
+			chunk_len = MIN_CHUNK_SIZE;
+		}
+		if (chunk_len > RLE_CHUNK_SIZE)
+		{
+			chunk_len = RLE_CHUNK_SIZE;
+		}
+
+		/* Blocks of the binary format never cross a chunk */
+		if (state->options->format == RLE_FORMAT_BINARY)
+		{
+			chunk_len = (chunk_len + COMP_BLOCK_SIZE - 1) / COMP_BLOCK_SIZE * COMP_BLOCK_SIZE;
+		}
+
+		while (nchunks < threads && done < len)
+		{
+			struct s_chunk *c = &chunks[nchunks];
+
+			/* Chunks of the binary format count their blocks from the offset of the chunk in the input */
+			c->state.options = state->options;
+			c->state.raw_pos = state->raw_pos + done;
+			c->state.index = state->index != NULL ? &c->index : NULL;
+			c->index.entries = NULL;
+			c->index.count = 0;
+			c->index.size = 0;
+
+			c->buf = buf + done;
+			c->len = len - done < chunk_len ? len - done : chunk_len;
+			done += c->len;
+
+			/* The first chunk is compressed by the calling thread, so is every chunk that gets no thread */
+			started[nchunks] = nchunks > 0 && pthread_create (&tids[nchunks], NULL, compress_chunk, c) == 0;
+			nchunks++;
+		}
+
+		for (i = 0; i < nchunks; i++)
+		{
+			if (started[i])
+			{
+				(void) pthread_join (tids[i], NULL);
+			}
+			else
+			{
+				(void) compress_chunk (&chunks[i]);
+			}
+		}
+
+		/* Stitch the chunks together in order, the open run of the state is merged with the first run of the
+		 * chunk and the last run of the chunk becomes the new open run.
+		 */
+		for (i = 0; i < nchunks; i++)
+		{
+			struct s_chunk *c = &chunks[i];
+
+			if (c->state.error != RLE_OK && state->error == RLE_OK)
+			{
+				state->error = c->state.error;
+			}
+			if (state->error != RLE_OK)
+			{
+				free (c->state.out_buf);
+				free (c->index.entries);
+				continue;
+			}
+
+			/* Blocks of the binary format are independent of each other, only the index entries of the chunk
+			 * have to be moved to the offset of the chunk in the output
+			 */
+			if (state->options->format == RLE_FORMAT_BINARY)
+			{
+				if (state->index != NULL)
+				{
+					uint64_t base = state->out_length + state->out_pos;
+					size_t k;
+
+					for (k = 0; k < c->index.count; k++)
+					{
+						(void) index_add (state, state->index, c->index.entries[2 * k],
+							base + c->index.entries[2 * k + 1]);
+					}
+					free (c->index.entries);
+				}
+				(void) append_output (state, c->state.out_buf, c->state.out_pos);
+				state->raw_pos += c->len;
+				free (c->state.out_buf);
+				continue;
+			}
+
+			if (state->count_x > 0 && state->prev_x == c->first_x)
+			{
+				state->count_x += c->first_count;
+			}
+			else
+			{
+				if (state->count_x > 0)
+				{
+					(void) emit_run (state);
+				}
+				state->prev_x = c->first_x;
+				state->count_x = c->first_count;
+			}
+
+			if (!c->single_run)
+			{
+				(void) emit_run (state);
+				(void) append_output (state, c->state.out_buf, c->state.out_pos);
+				state->prev_x = c->state.prev_x;
+				state->count_x = c->state.count_x;
+			}
+
+			free (c->state.out_buf);
+		}
+
+		buf += done;
+		len -= done;
+	}
+}
+
+
+static void *compress_chunk (void *arg)
+{
+	struct s_chunk *c = arg;
+	size_t first;
+
+	c->state.sink = NULL;
+	c->state.out_pos = 0;
+	c->state.out_length = 0;
+	c->state.error = RLE_OK;
+
+	if (c->state.options->format == RLE_FORMAT_BINARY)
+	{
+		size_t blocks = (c->len + COMP_BLOCK_SIZE - 1) / COMP_BLOCK_SIZE;
+
+		c->state.out_size = blocks * COMP_BLOCK_BOUND(COMP_BLOCK_SIZE);
+		c->state.tokens = NULL;
+		if ((c->state.out_buf = malloc (c->state.out_size)) == NULL
+			|| (c->state.options->level > 0 && (c->state.tokens = malloc (COMP_PAYLOAD_BOUND(COMP_BLOCK_SIZE))) == NULL))
+		{
+			c->state.error = RLE_ERROR_MEMORY;
+			return NULL;
+		}
+		(void) compress_blocks (&c->state, c->buf, c->len);
+		free (c->state.tokens);
+		return NULL;
+	}
+
+	first = run_length (c->buf, c->len);
+
+	c->first_x = c->buf[0];
+	c->first_count = first;
+	c->single_run = first == c->len;
+
+	/* A run never takes more than twice its length, so the output buffer never has to be flushed */
+	c->state.out_size = 2 * (c->len - first) + RLE_RUN_MAX_LEN;
+	if ((c->state.out_buf = malloc (c->state.out_size)) == NULL)
+	{
+		c->state.error = RLE_ERROR_MEMORY;
+		return NULL;
+	}
+
+	if (!c->single_run)
+	{
+		c->state.prev_x = c->buf[first];
+		c->state.count_x = 0;
+		(void) compress_block (&c->state, c->buf + first, c->len - first);
+	}
+
+	return NULL;
+}
+
+
+static void flush_output (struct s_rle_state *state)
+{
+	/* After an error nothing reaches the sink anymore */
+	if (state->out_pos > 0 && state->error == RLE_OK && state->sink (state->opaque, state->out_buf, state->out_pos) != 0)
+	{
+		state->error = RLE_ERROR_SINK;
+	}
+	state->out_length += state->out_pos;
+	state->out_pos = 0;
+}
+
+
+static void append_output (struct s_rle_state *state, const char *buf, size_t len)
+{
+	/* Small pieces go through the buffer, large ones are handed to the sink directly */
+	if (state->out_pos + len > state->out_size)
+	{
+		(void) flush_output (state);
+	}
+	if (len > state->out_size)
+	{
+		if (state->error == RLE_OK && state->sink (state->opaque, buf, len) != 0)
+		{
+			state->error = RLE_ERROR_SINK;
+		}
+		state->out_length += len;
+	}
+	else
+	{
+		(void) memcpy (state->out_buf + state->out_pos, buf, len);
+		state->out_pos += len;
+	}
+}
+
+
+static void emit_run (struct s_rle_state *state)
+{
+	uint64_t count = state->count_x;
+
+	/* Runs that are too long for the format are split into several runs of the same char */
+	while (count > 0)
+	{
+		uint32_t n = count > RLE_RUN_COUNT_MAX ? RLE_RUN_COUNT_MAX : (uint32_t) count;
+
+		if (state->out_pos > state->out_size - RLE_RUN_MAX_LEN)
+		{
+			(void) flush_output (state);
+		}
+		state->out_pos += encode_run (state->out_buf + state->out_pos, state->prev_x, n);
+		count -= n;
+	}
+}
+
+
+static void index_add (struct s_rle_state *state, struct s_index *index, uint64_t raw, uint64_t comp)
+{
+	if (index->count == index->size)
+	{
+		size_t size = index->size == 0 ? 64 : 2 * index->size;
+		uint64_t *entries = realloc (index->entries, 2 * sizeof(uint64_t) * size);
+
+		if (entries == NULL)
+		{
+			state->error = RLE_ERROR_MEMORY;
+			return;
+		}
+		index->entries = entries;
+		index->size = size;
+	}
+	index->entries[2 * index->count] = raw;
+	index->entries[2 * index->count + 1] = comp;
+	index->count++;
+}
+
+
+static void write_index (struct s_rle_state *state)
+{
+	uint64_t index_offset = state->out_length + state->out_pos;
+	char entry[COMP_INDEX_ENTRY_LEN];
+	size_t i;
+
+	for (i = 0; i < state->index->count; i++)
+	{
+		(void) encode_u64 (entry, state->index->entries[2 * i]);
+		(void) encode_u64 (entry + 8, state->index->entries[2 * i + 1]);
+		(void) append_output (state, entry, COMP_INDEX_ENTRY_LEN);
+	}
+
+	(void) encode_u64 (entry, index_offset);
+	(void) encode_u64 (entry + 8, state->index->count);
+	(void) append_output (state, entry, COMP_INDEX_ENTRY_LEN);
+	(void) append_output (state, COMP_INDEX_MAGIC, COMP_MAGIC_LEN);
+}
+
+/* === Encoders === */
+
+static void encode_u64 (char *dst, uint64_t v)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		dst[i] = (char) (v >> (8 * i));
+	}
+}
+
+
+static size_t encode_block (char *dst, unsigned char *tokens, int checksum, const unsigned char *buf, size_t len)
+{
+	char *payload = dst + COMP_BLOCK_HEADER_MAX;
+	size_t header_len = 0, payload_len = 0, huff_len = 0, i;
+	int mode = estimate_mode (tokens != NULL, buf, len);
+	uint32_t crc = 0;
+
+	/* The payload goes behind the largest possible header and is moved to the actual one afterwards */
+	if (mode == COMP_MODE_RLE)
+	{
+		payload_len = encode_tokens (payload, buf, len);
+	}
+	else if (mode == COMP_MODE_HUFF)
+	{
+		/* The Huffman coded tokens only replace the tokens if they are shorter, including their length */
+		size_t token_len = encode_tokens ((char *) tokens, buf, len);
+		size_t n = encode_varint (payload, token_len);
+
+		if (token_len > n + 1)
+		{
+			huff_len = huff_encode ((unsigned char *) payload + n, token_len - n - 1, tokens, token_len);
+		}
+		if (huff_len > 0)
+		{
+			payload_len = n + huff_len;
+		}
+		else
+		{
+			mode = COMP_MODE_RLE;
+			(void) memcpy (payload, tokens, token_len);
+			payload_len = token_len;
+		}
+	}
+
+	/* Stored blocks are also the way out if the sample was wrong */
+	if (mode == COMP_MODE_STORED || payload_len >= len)
+	{
+		mode = COMP_MODE_STORED;
+		payload_len = len;
+	}
+
+	/* The header can't reach the payload that waits behind the largest possible one */
+	dst[header_len++] = (char) mode;
+	header_len += encode_varint (dst + header_len, len);
+	header_len += encode_varint (dst + header_len, payload_len);
+
+	if (mode == COMP_MODE_STORED)
+	{
+		/* Copied straight behind the header, the CRC reads every piece while it is still in the cache */
+		for (i = 0; i < len; i += CRC_STEP)
+		{
+			size_t n = len - i < CRC_STEP ? len - i : CRC_STEP;
+
+			(void) memcpy (dst + header_len + i, buf + i, n);
+			crc = checksum ? crc32c (crc, dst + header_len + i, n) : crc;
+		}
+	}
+	else
+	{
+		(void) memmove (dst + header_len, payload, payload_len);
+		crc = checksum ? crc32c (0, buf, len) : crc;
+	}
+
+	if (checksum)
+	{
+		for (i = 0; i < COMP_CRC_LEN; i++)
+		{
+			dst[header_len + payload_len + i] = (char) (crc >> (8 * i));
+		}
+		return header_len + payload_len + COMP_CRC_LEN;
+	}
+
+	return header_len + payload_len;
+}
+
+
+static int estimate_mode (int huff, const unsigned char *buf, size_t len)
+{
+	unsigned char sample[COMP_PAYLOAD_BOUND(SAMPLE_COUNT * SAMPLE_LEN)];
+	unsigned char coded[COMP_PAYLOAD_BOUND(SAMPLE_COUNT * SAMPLE_LEN)];
+	const size_t raw = SAMPLE_COUNT * SAMPLE_LEN;
+	size_t sample_len = 0, huff_len;
+
+	if (len < SAMPLE_MIN_BLOCK)
+	{
+		return huff ? COMP_MODE_HUFF : COMP_MODE_RLE;
+	}
+
+	for (size_t i = 0; i < SAMPLE_COUNT; i++)
+	{
+		sample_len += encode_tokens ((char *) sample + sample_len, buf + i * (len / SAMPLE_COUNT), SAMPLE_LEN);
+	}
+
+	if (huff && sample_len > 0)
+	{
+		/* The code lengths table is paid once per block, not once per sample */
+		huff_len = huff_encode (coded, sizeof(coded), sample, sample_len);
+
+		if (huff_len > COMP_HUFF_TABLE_LEN && huff_len - COMP_HUFF_TABLE_LEN < raw - raw / SAMPLE_GAIN
+			&& huff_len - COMP_HUFF_TABLE_LEN < sample_len - sample_len / SAMPLE_GAIN)
+		{
+			return COMP_MODE_HUFF;
+		}
+	}
+
+	return sample_len < raw - raw / SAMPLE_GAIN ? COMP_MODE_RLE : COMP_MODE_STORED;
+}
+
+
+HOT_CLONES
+static size_t encode_tokens (char *dst, const unsigned char *buf, size_t len)
+{
+	size_t i = 0, out = 0, literal = 0;
+
+	while (i <= len)
+	{
+		size_t run = i + 1 < len && buf[i + 1] != buf[i] ? 1 : i < len ? run_length (buf + i, len - i) : 0;
+
+		/* A run of two only extends a pending literal, at the end of the input every literal is flushed */
+		if (i == len || run >= 3 || (run == 2 && literal == 0))
+		{
+			const unsigned char *lit = buf + i - literal;
+
+			while (literal > 0)
+			{
+				size_t n = literal < COMP_LITERAL_MAX ? literal : COMP_LITERAL_MAX;
+
+				dst[out++] = (char) (n - 1);
+				(void) memcpy (dst + out, lit, n);
+				out += n;
+				lit += n;
+				literal -= n;
+			}
+
+			if (i == len)
+			{
+				break;
+			}
+
+			if (run - COMP_REPEAT_MIN < COMP_REPEAT_ESCAPE)
+			{
+				dst[out++] = (char) (COMP_REPEAT_FLAG | (run - COMP_REPEAT_MIN));
+				dst[out++] = (char) buf[i];
+			}
+			else
+			{
+				dst[out++] = (char) (COMP_REPEAT_FLAG | COMP_REPEAT_ESCAPE);
+				dst[out++] = (char) buf[i];
+				out += encode_varint (dst + out, run - COMP_REPEAT_MIN - COMP_REPEAT_ESCAPE);
+			}
+		}
+		else
+		{
+			literal += run;
+		}
+
+		i += run;
+	}
+
+	return out;
+}
+
+
+static size_t encode_varint (char *dst, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80)
+	{
+		dst[n++] = (char) (v | 0x80);
+		v >>= 7;
+	}
+	dst[n++] = (char) v;
+
+	return n;
+}
+
+
+static size_t encode_run (char *dst, int c, uint32_t count)
+{
+	char digits[10];
+	size_t n = sizeof(digits), len;
+	uint32_t v = count;
+
+	/* Fill the digits from the back, two at a time */
+	while (v >= 100)
+	{
+		uint32_t pair = (v % 100) * 2;
+		v /= 100;
+		digits[--n] = digit_pairs[pair + 1];
+		digits[--n] = digit_pairs[pair];
+	}
+	if (v >= 10)
+	{
+		digits[--n] = digit_pairs[v * 2 + 1];
+		digits[--n] = digit_pairs[v * 2];
+	}
+	else
+	{
+		digits[--n] = (char) ('0' + v);
+	}
+
+	len = sizeof(digits) - n;
+	dst[0] = (char) c;
+	(void) memcpy (dst + 1, digits + n, len);
+
+	return len + 1;
+}
+
+/* === Run length kernels === */
+
+static size_t run_length_scalar (const unsigned char *buf, size_t len)
+{
+	size_t i = 1;
+
+	/* Compare every char with its predecessor until they differ */
+	while (i < len && buf[i] == buf[i - 1])
+	{
+		i++;
+	}
+
+	return i;
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+
+__attribute__((target("sse2")))
+static size_t run_length_sse2 (const unsigned char *buf, size_t len)
+{
+	size_t i = 1;
+
+	/* Most runs in text are a single char, don't bother the vector unit for them */
+	if (len < 2 || buf[1] != buf[0])
+	{
+		return 1;
+	}
+
+	/* buf[i-1 .. i+14] against buf[i .. i+15], a clear bit in the mask is a run boundary */
+	while (i + 16 <= len)
+	{
+		__m128i a = _mm_loadu_si128 ((const __m128i *) (buf + i - 1));
+		__m128i b = _mm_loadu_si128 ((const __m128i *) (buf + i));
+		unsigned int neq = ~(unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (a, b)) & 0xffffu;
+
+		if (neq != 0)
+		{
+			return i + (size_t) __builtin_ctz (neq);
+		}
+		i += 16;
+	}
+
+	while (i < len && buf[i] == buf[i - 1])
+	{
+		i++;
+	}
+
+	return i;
+}
+
+
+__attribute__((target("avx2,bmi")))
+static size_t run_length_avx2 (const unsigned char *buf, size_t len)
+{
+	size_t i = 1;
+
+	if (len < 2 || buf[1] != buf[0])
+	{
+		return 1;
+	}
+
+	while (i + 32 <= len)
+	{
+		__m256i a = _mm256_loadu_si256 ((const __m256i *) (buf + i - 1));
+		__m256i b = _mm256_loadu_si256 ((const __m256i *) (buf + i));
+		unsigned int neq = ~(unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (a, b));
+
+		if (neq != 0)
+		{
+			return i + _tzcnt_u32 (neq);
+		}
+		i += 32;
+	}
+
+	return i + run_length_sse2 (buf + i - 1, len - i + 1) - 1;
+}
+
+
+__attribute__((target("avx512f,avx512bw,bmi")))
+static size_t run_length_avx512 (const unsigned char *buf, size_t len)
+{
+	size_t i = 1;
+
+	if (len < 2 || buf[1] != buf[0])
+	{
+		return 1;
+	}
+
+	while (i + 64 <= len)
+	{
+		__m512i a = _mm512_loadu_si512 ((const void *) (buf + i - 1));
+		__m512i b = _mm512_loadu_si512 ((const void *) (buf + i));
+		unsigned long long neq = _mm512_cmpneq_epi8_mask (a, b);
+
+		if (neq != 0)
+		{
+			return i + (size_t) __builtin_ctzll (neq);
+		}
+		i += 64;
+	}
+
+	return i + run_length_avx2 (buf + i - 1, len - i + 1) - 1;
+}
+
+
+#endif
+
+
+static void select_run_length (void)
+{
+	const char *force = getenv ("MYCOMPRESS_SIMD");
+	int level = 3; /*< 0 scalar, 1 sse2, 2 avx2, 3 avx512 */
+
+	run_length = run_length_scalar;
+
+	if (force != NULL)
+	{
+		if (strcmp (force, "scalar") == 0)
+		{
+			level = 0;
+		}
+		else if (strcmp (force, "sse2") == 0)
+		{
+			level = 1;
+		}
+		else if (strcmp (force, "avx2") == 0)
+		{
+			level = 2;
+		}
+	}
+
+#ifdef HAVE_X86_SIMD
+	{
+		unsigned int eax, ebx, ecx, edx, xcr0 = 0;
+		int avx_os = 0;
+
+		if (level < 1 || __get_cpuid (1, &eax, &ebx, &ecx, &edx) == 0)
+		{
+			return;
+		}
+		if ((edx & bit_SSE2) != 0)
+		{
+			run_length = run_length_sse2;
+		}
+
+		/* The OS has to save the wider registers too, ask XGETBV */
+		if ((ecx & bit_OSXSAVE) != 0)
+		{
+			__asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+			avx_os = (xcr0 & 0x06) == 0x06;
+		}
+		if (level < 2 || !avx_os || (ecx & bit_AVX) == 0 || __get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) == 0)
+		{
+			return;
+		}
+		if ((ebx & bit_AVX2) != 0 && (ebx & bit_BMI) != 0)
+		{
+			run_length = run_length_avx2;
+		}
+		if (level >= 3 && (xcr0 & 0xe0) == 0xe0 && (ebx & bit_AVX512F) != 0 && (ebx & bit_AVX512BW) != 0
+			&& (ebx & bit_BMI) != 0)
+		{
+			run_length = run_length_avx512;
+		}
+	}
+#endif
+}
@@ -0,0 +1,164 @@
+/**
+ * @file rle.h
+ * @author Constantin Schieber, e1228774
+ * @brief Streaming run length compression, the library mycompress is built on
+ * @details A compression is a context that is fed with any amount of input by rle_update() and completed by
+ * rle_finish(). The compressed output is handed to a sink callback whenever the output buffer of the context is full
+ * and once more by rle_finish(). Contexts are independent of each other, several of them can be used by different
+ * threads at the same time. Nothing in the library terminates the program, every error is returned as one of the
+ * negative RLE_ERROR codes and sticks to the context: every later call on it returns the same error.
+ *
+ * Usage:
+ *
+ *	struct rle_options options = { RLE_FORMAT_BINARY, 1, 0, 0, 1 };
+ *	struct rle_context *ctx;
+ *
+ *	if (rle_init (&ctx, &options, sink, opaque) == RLE_OK)
+ *	{
+ *		while (... more input ...)
+ *			err = rle_update (ctx, buf, len);
+ *		err = rle_finish (ctx);
+ *		rle_free (ctx);
+ *	}
+ * @date 17.10.2026
+ */
+
+#ifndef RLE_H
+#define RLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Output formats, see comp_format.h */
+#define RLE_FORMAT_LEGACY (1)
+#define RLE_FORMAT_BINARY (2)
+
+/* Highest level of struct rle_options */
+#define RLE_LEVEL_MAX (1)
+
+/* Upper limit for the threads of one context */
+#define RLE_MAX_THREADS (256)
+
+/* Largest part of the input one thread compresses at once, updates of threads * RLE_CHUNK_SIZE chars keep every
+ * thread busy
+ */
+#define RLE_CHUNK_SIZE (4 << 20)
+
+/* Longest count of one legacy run, longer runs are split into several runs of the same char. Readers of the legacy
+ * format store the count in an int.
+ */
+#define RLE_RUN_COUNT_MAX (2147483647)
+
+/* Longest encoded run: one sign plus the decimal digits of RLE_RUN_COUNT_MAX */
+#define RLE_RUN_MAX_LEN (1 + 10)
+
+/* Return codes */
+#define RLE_OK (0)
+#define RLE_ERROR_ARGUMENT (-1)	/*< Invalid options or arguments */
+#define RLE_ERROR_MEMORY (-2)	/*< Out of memory */
+#define RLE_ERROR_SINK (-3)	/*< The sink reported an error */
+#define RLE_ERROR_FINISHED (-4)	/*< The context is finished already */
+
+/**
+ * @brief Receives compressed output
+ * @param opaque The opaque pointer given to rle_init()
+ * @param buf A reference to the compressed chars
+ * @param len The amount of chars, never 0
+ * @return 0 on success, anything else fails the compression with RLE_ERROR_SINK
+ */
+typedef int (*rle_sink) (void *opaque, const char *buf, size_t len);
+
+/* Options of a compression */
+struct rle_options
+{
+	int format;			/*< RLE_FORMAT_LEGACY or RLE_FORMAT_BINARY */
+	int threads;			/*< Threads per update, 1 to RLE_MAX_THREADS */
+	uint64_t index_interval;	/*< Binary format: chars between two block index entries, a multiple of
+					 *  COMP_BLOCK_SIZE, 0 for no index */
+	int level;			/*< Binary format: 0 stores the tokens as they are, 1 Huffman codes them where
+					 *  that is shorter */
+	int checksum;			/*< Binary format: 1 appends the CRC-32C of its chars to every block */
+};
+
+/* State of one compression, opaque */
+struct rle_context;
+
+/**
+ * @brief Creates a context
+ * @details The header of the binary format is buffered immediately.
+ * @param ctx Set to the new context
+ * @param options A reference to the options, NULL for the legacy format with one thread and no index
+ * @param sink The callback that receives the output
+ * @param opaque Passed to every call of sink
+ * @return RLE_OK, RLE_ERROR_ARGUMENT or RLE_ERROR_MEMORY
+ */
+int rle_init (struct rle_context **ctx, const struct rle_options *options, rle_sink sink, void *opaque);
+
+/**
+ * @brief Compresses the next part of the input
+ * @details The parts don't have to be aligned to anything, a run or block that reaches the end of the part is
+ * continued by the next one.
+ * @param ctx A reference to the context
+ * @param buf A reference to the input
+ * @param len The amount of chars
+ * @return RLE_OK or the error of the context
+ */
+int rle_update (struct rle_context *ctx, const void *buf, size_t len);
+
+/**
+ * @brief Writes the end of the compressed stream and hands all buffered output to the sink
+ * @param ctx A reference to the context
+ * @return RLE_OK or the error of the context
+ */
+int rle_finish (struct rle_context *ctx);
+
+/**
+ * @brief Starts a new stream on a context, with the same options and sink
+ * @details The buffers of the context are kept, so compressing many small inputs one after the other doesn't
+ * allocate anything. Output of an unfinished stream that was not handed to the sink yet is dropped. The header of
+ * the binary format is buffered immediately.
+ * @param ctx A reference to the context
+ * @return RLE_OK or the error of the context, a context that failed can't be reset
+ */
+int rle_reset (struct rle_context *ctx);
+
+/**
+ * @brief Releases a context, finished or not
+ * @param ctx A reference to the context, may be NULL
+ */
+void rle_free (struct rle_context *ctx);
+
+/**
+ * @brief Returns the amount of chars given to rle_update() so far
+ * @param ctx A reference to the context
+ * @return The amount of chars
+ */
+uint64_t rle_in_count (const struct rle_context *ctx);
+
+/**
+ * @brief Returns the amount of compressed chars so far, including the ones that wait in the output buffer
+ * @param ctx A reference to the context
+ * @return The amount of chars
+ */
+uint64_t rle_out_count (const struct rle_context *ctx);
+
+/**
+ * @brief Describes a return code
+ * @param error The return code
+ * @return A static string
+ */
+const char *rle_strerror (int error);
+
+/**
+ * @brief Encodes one run of the legacy format
+ * @details For callers that compress the parts of an input with contexts of their own: the first and the last run
+ * of every part are left out of its context and joined with the neighbouring parts, the joined runs are encoded
+ * here.
+ * @param dst A reference to the output buffer, at least RLE_RUN_MAX_LEN chars have to be free
+ * @param c The char of the run
+ * @param count The amount of occurences of c, 1 to RLE_RUN_COUNT_MAX
+ * @return The amount of chars written to dst
+ */
+size_t rle_encode_run (char *dst, int c, uint32_t count);
+
+#endif
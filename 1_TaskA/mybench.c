@@ -0,0 +1,532 @@
+/**
+ * @file mybench.c
+ * @author Constantin Schieber (1228774) <e1228774@student.tuwien.ac.at>
+ * @brief Measures the throughput of filters like myexpand and unexpand on
+ * generated text
+ * @details Generates three corpora of the same size from a fixed seed:
+ * indented source code, a table padded with spaces and prose with single
+ * spaces. Existing corpora of the right size are reused. Every filter that
+ * is given as argument reads every corpus on stdin, the fastest of several
+ * runs counts. The results are written to stdout as CSV: throughput in
+ * MB/s, size and FNV-1a hash of the output, so filters that should agree
+ * can be checked against each other, and peak RSS in KiB.
+ *
+ * A filter is one argument with its command line, e.g. "unexpand -a" or
+ * "./myexpand -a -j 4". Leading words of the form NAME=VALUE are set in
+ * the environment of the filter, e.g. "MYEXPAND_SIMD=scalar ./myexpand".
+ * @date 17.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* === Constants === */
+
+/* Default size of every corpus in MiB */
+#define DEFAULT_SIZE (64)
+
+/* Default number of runs per filter and corpus */
+#define DEFAULT_RUNS (3)
+
+/* Most words of one filter command line */
+#define MAX_WORDS (32)
+
+/* Size of the buffer a corpus is generated in, and the output is hashed
+ * in */
+#define GEN_BUF_SIZE (1 << 20)
+
+/* Longest line the generators write */
+#define MAX_LINE (256)
+
+/* === Type Definitions === */
+
+/* A corpus and the function that writes one line of it into line, the
+ * generator gets the state of the random number generator */
+struct corpus {
+    const char *name;
+    size_t (*generate)(char *line, uint64_t *seed);
+};
+
+/* === Global Variables === */
+
+/* Name of the program */
+static const char *pgm_name = "mybench";
+
+/* Words of the corpora, the first ones are the most frequent */
+static const char *const words[] = {
+    "the", "of", "and", "to", "a", "in", "is", "it", "you", "that", "he",
+    "was", "for", "on", "are", "with", "as", "his", "they", "be", "at",
+    "one", "have", "this", "from", "or", "had", "by", "word", "but", "what",
+    "some", "we", "can", "out", "other", "were", "all", "there", "when",
+    "up", "use", "your", "how", "said", "an", "each", "she", "which", "do",
+    "their", "time", "if", "will", "way", "about", "many", "then", "them",
+    "write", "would", "like", "so", "these", "her", "long", "make", "thing"
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * Returns the next number of a xorshift64* random number generator.
+ *
+ * @param seed The state of the generator.
+ * @return The random number.
+ */
+static uint64_t next_random(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+
+    return *seed * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+/**
+ * Appends a random word, the product of two uniform indices favours the
+ * first words.
+ *
+ * @param line The line.
+ * @param len The length of the line so far.
+ * @param seed The state of the random number generator.
+ * @return The length of the line with the word.
+ */
+static size_t add_word(char *line, size_t len, uint64_t *seed)
+{
+    uint64_t r = next_random(seed);
+    const char *w = words[(r % WORD_COUNT) * ((r >> 16) % WORD_COUNT)
+        / WORD_COUNT];
+    size_t n = strlen(w);
+
+    (void) memcpy(line + len, w, n);
+
+    return len + n;
+}
+
+/**
+ * Appends spaces.
+ *
+ * @param line The line.
+ * @param len The length of the line so far.
+ * @param count The number of spaces.
+ * @return The length of the line with the spaces.
+ */
+static size_t add_spaces(char *line, size_t len, size_t count)
+{
+    (void) memset(line + len, ' ', count);
+
+    return len + count;
+}
+
+/**
+ * Writes a line of source code: indented by four spaces per level, a few
+ * words and sometimes a comment that is aligned at column 40.
+ *
+ * @param line The line.
+ * @param seed The state of the random number generator.
+ * @return The length of the line.
+ */
+static size_t generate_code(char *line, uint64_t *seed)
+{
+    uint64_t r = next_random(seed);
+    size_t len = add_spaces(line, 0, 4 * (r % 6)), words_left = 1 + (r >> 8) % 6;
+
+    if ((r >> 16) % 8 == 0) {
+        line[0] = '\n';
+        return 1;
+    }
+    while (words_left-- > 0) {
+        len = add_word(line, len, seed);
+        line[len++] = words_left > 0 ? ' ' : ';';
+    }
+    if ((r >> 24) % 3 == 0) {
+        len = add_spaces(line, len, len < 40 ? 40 - len : 1);
+        line[len++] = '/';
+        line[len++] = '*';
+        line[len++] = ' ';
+        len = add_word(line, len, seed);
+        line[len++] = ' ';
+        line[len++] = '*';
+        line[len++] = '/';
+    }
+    line[len++] = '\n';
+
+    return len;
+}
+
+/**
+ * Writes a row of a table with eight columns, like expand writes a tab
+ * separated file: every field is padded with spaces to the next multiple
+ * of 8.
+ *
+ * @param line The line.
+ * @param seed The state of the random number generator.
+ * @return The length of the line.
+ */
+static size_t generate_table(char *line, uint64_t *seed)
+{
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        if (i > 0) {
+            len = add_spaces(line, len, 8 - len % 8);
+        }
+        len = add_word(line, len, seed);
+        if (next_random(seed) % 2 == 0) {
+            len = add_word(line, len, seed);
+        }
+    }
+    line[len++] = '\n';
+
+    return len;
+}
+
+/**
+ * Writes a line of prose of about 70 chars, the words are separated by
+ * single spaces.
+ *
+ * @param line The line.
+ * @param seed The state of the random number generator.
+ * @return The length of the line.
+ */
+static size_t generate_prose(char *line, uint64_t *seed)
+{
+    size_t len = add_word(line, 0, seed);
+
+    while (len < 70) {
+        line[len++] = ' ';
+        len = add_word(line, len, seed);
+    }
+    line[len++] = '\n';
+
+    return len;
+}
+
+/* === Corpora === */
+
+static const struct corpus corpora[] = {
+    { "code.txt", generate_code },
+    { "table.txt", generate_table },
+    { "prose.txt", generate_prose }
+};
+
+#define CORPUS_COUNT (sizeof(corpora) / sizeof(corpora[0]))
+
+/**
+ * Writes a corpus unless a file of the same name and size exists already.
+ * The last line is cut at the size.
+ *
+ * @param c The corpus.
+ * @param path The name of the file.
+ * @param size The size of the corpus in chars.
+ * @return void
+ */
+static void write_corpus(const struct corpus *c, const char *path,
+    off_t size)
+{
+    uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+    char *buf;
+    struct stat st;
+    FILE *f;
+
+    if (stat(path, &st) == 0 && st.st_size == size) {
+        return;
+    }
+    if ((buf = malloc(GEN_BUF_SIZE + MAX_LINE)) == NULL) {
+        bail_out(EXIT_FAILURE, "Error while allocating memory");
+    }
+    if ((f = fopen(path, "w")) == NULL) {
+        bail_out(EXIT_FAILURE, "Error while opening %s", path);
+    }
+
+    while (size > 0) {
+        size_t len = 0;
+
+        while (len < GEN_BUF_SIZE && (off_t) len < size) {
+            len += c->generate(buf + len, &seed);
+        }
+        if ((off_t) len > size) {
+            len = (size_t) size;
+        }
+        if (fwrite(buf, 1, len, f) != len) {
+            bail_out(EXIT_FAILURE, "Error while writing %s", path);
+        }
+        size -= (off_t) len;
+    }
+
+    if (fclose(f) == EOF) {
+        bail_out(EXIT_FAILURE, "Error while writing %s", path);
+    }
+    free(buf);
+}
+
+/**
+ * Runs a filter with a corpus on stdin and a file on stdout and waits for
+ * it.
+ *
+ * @param command The command line of the filter.
+ * @param in The name of the corpus.
+ * @param out The name of the output file.
+ * @param max_rss Set to the peak RSS of the filter in KiB.
+ * @return The wall clock time of the run in seconds.
+ */
+static double run_filter(const char *command, const char *in,
+    const char *out, long *max_rss)
+{
+    struct timespec start, stop;
+    struct rusage usage;
+    char line[4096], *argv[MAX_WORDS + 1], *word;
+    int argc = 0, status, in_fd, out_fd;
+    pid_t pid;
+
+    if (strlen(command) >= sizeof(line)) {
+        errno = 0;
+        bail_out(EXIT_FAILURE, "Command line too long: %s", command);
+    }
+    (void) strcpy(line, command);
+
+    /* Split the command line at blanks, NAME=VALUE words in front of the
+     * program go to the environment */
+    for (word = strtok(line, " \t"); word != NULL;
+        word = strtok(NULL, " \t")) {
+        if (argc == MAX_WORDS) {
+            errno = 0;
+            bail_out(EXIT_FAILURE, "Too many words: %s", command);
+        }
+        argv[argc++] = word;
+    }
+    argv[argc] = NULL;
+    if (argc == 0) {
+        errno = 0;
+        bail_out(EXIT_FAILURE, "Empty command line");
+    }
+
+    if ((in_fd = open(in, O_RDONLY)) == -1) {
+        bail_out(EXIT_FAILURE, "Error while opening %s", in);
+    }
+    if ((out_fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        bail_out(EXIT_FAILURE, "Error while opening %s", out);
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((pid = fork()) == -1) {
+        bail_out(EXIT_FAILURE, "Error while forking");
+    }
+    if (pid == 0) {
+        char **args = argv;
+
+        while (*args != NULL && args[1] != NULL && strchr(*args, '=') != NULL
+            && **args != '=') {
+            (void) putenv(*args++);
+        }
+        if (dup2(in_fd, STDIN_FILENO) == -1
+            || dup2(out_fd, STDOUT_FILENO) == -1) {
+            bail_out(EXIT_FAILURE, "Error while redirecting %s", args[0]);
+        }
+        (void) close(in_fd);
+        (void) close(out_fd);
+
+        (void) execvp(args[0], args);
+        bail_out(127, "Error while executing %s", args[0]);
+    }
+
+    while (wait4(pid, &status, 0, &usage) == -1) {
+        if (errno != EINTR) {
+            bail_out(EXIT_FAILURE, "Error while waiting for %s", command);
+        }
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &stop);
+    (void) close(in_fd);
+    (void) close(out_fd);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        errno = 0;
+        bail_out(EXIT_FAILURE, "\"%s\" failed on %s", command, in);
+    }
+
+    *max_rss = usage.ru_maxrss;
+
+    return (double) (stop.tv_sec - start.tv_sec)
+        + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Returns the FNV-1a hash of a file.
+ *
+ * @param path The name of the file.
+ * @param size Set to the size of the file.
+ * @return The hash.
+ */
+static uint64_t hash_file(const char *path, uint64_t *size)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    unsigned char *buf;
+    size_t n, i;
+    FILE *f;
+
+    if ((buf = malloc(GEN_BUF_SIZE)) == NULL) {
+        bail_out(EXIT_FAILURE, "Error while allocating memory");
+    }
+    if ((f = fopen(path, "r")) == NULL) {
+        bail_out(EXIT_FAILURE, "Error while opening %s", path);
+    }
+    *size = 0;
+    while ((n = fread(buf, 1, GEN_BUF_SIZE, f)) > 0) {
+        for (i = 0; i < n; i++) {
+            hash = (hash ^ buf[i]) * UINT64_C(0x100000001b3);
+        }
+        *size += n;
+    }
+    if (ferror(f)) {
+        bail_out(EXIT_FAILURE, "Error while reading %s", path);
+    }
+    (void) fclose(f);
+    free(buf);
+
+    return hash;
+}
+
+/**
+ * Prints the synopsis of the program and terminates.
+ *
+ * @return void
+ */
+static void usage(void)
+{
+    errno = 0;
+    bail_out(EXIT_FAILURE, "Usage: %s [-d dir] [-n runs] [-s MiB] filter ...",
+        pgm_name);
+}
+
+/**
+ * The main entry point of the program.
+ *
+ * @param argc The number of command-line parameters in argv.
+ * @param argv The array of command-line paramters, argc elements long.
+ * @return The exit code of the program. 0 on success, non-zero on failure.
+ */
+int main(int argc, char **argv)
+{
+    const char *dir = "bench_data";
+    long size = DEFAULT_SIZE, runs = DEFAULT_RUNS, n;
+    char *end;
+    size_t c;
+    int opt, i;
+
+    pgm_name = argv[0];
+
+    while ((opt = getopt(argc, argv, "d:n:s:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+        case 's':
+            errno = 0;
+            n = strtol(optarg, &end, 10);
+            if (errno != 0 || *end != '\0' || n < 1 || n > 4096) {
+                usage();
+            }
+            if (opt == 'n') {
+                runs = n;
+            } else {
+                size = n;
+            }
+            break;
+        default: /* '?' */
+            usage();
+        }
+    }
+    if (optind == argc) {
+        usage();
+    }
+
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        bail_out(EXIT_FAILURE, "Error while creating %s", dir);
+    }
+
+    (void) printf("filter,corpus,bytes,seconds,mb_per_s,out_bytes,out_hash,"
+        "max_rss_kb\n");
+    (void) fflush(stdout);
+
+    for (c = 0; c < CORPUS_COUNT; c++) {
+        char path[4096], out_path[4096 + 5];
+        off_t bytes = (off_t) size << 20;
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir, corpora[c].name)
+            >= (int) sizeof(path)) {
+            errno = 0;
+            bail_out(EXIT_FAILURE, "Name of the directory too long");
+        }
+        (void) snprintf(out_path, sizeof(out_path), "%s.out", path);
+        write_corpus(&corpora[c], path, bytes);
+
+        for (i = optind; i < argc; i++) {
+            double best = 0.0;
+            long max_rss = 0, r;
+            uint64_t out_bytes, hash;
+
+            for (r = 0; r < runs; r++) {
+                long rss;
+                double seconds = run_filter(argv[i], path, out_path, &rss);
+
+                if (r == 0 || seconds < best) {
+                    best = seconds;
+                }
+                if (rss > max_rss) {
+                    max_rss = rss;
+                }
+            }
+            hash = hash_file(out_path, &out_bytes);
+
+            (void) printf("\"%s\",%s,%lld,%.6f,%.1f,%llu,%016llx,%ld\n",
+                argv[i], corpora[c].name, (long long) bytes, best,
+                best > 0 ? (double) bytes / best / 1e6 : 0.0,
+                (unsigned long long) out_bytes, (unsigned long long) hash,
+                max_rss);
+            (void) fflush(stdout);
+
+            (void) unlink(out_path);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void bail_out(int exitcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    (void) fprintf(stderr, "%s: ", pgm_name);
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        (void) vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+    if (errno != 0) {
+        (void) fprintf(stderr, ": %s", strerror(errno));
+    }
+    (void) fprintf(stderr, "\n");
+
+    exit(exitcode);
+}
@@ -12,75 +12,2203 @@
 #include <errno.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "charwidth.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
+/* === Macros === */
+
+/*
+ * Marks the hot loops. GCC builds them for the baseline x86-64 and for
+ * x86-64-v2, -v3 (AVX2, BMI2) and -v4 (AVX-512), the dynamic loader picks
+ * the variant of the CPU once (ifunc). Other compilers and architectures,
+ * or a build with -DNO_CLONES, get the plain function.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) \
+    && __GNUC__ >= 11 && defined(__gnu_linux__) && !defined(NO_CLONES)
+#define HOT_CLONES __attribute__((target_clones("default", \
+    "arch=x86-64-v2", "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define HOT_CLONES
+#endif
+
+/* === Constants === */
+
+/* Size of the input buffer, every read fills it. */
+#define IN_BUF_SIZE (128 * 1024)
+
+/* Size of the output buffer, it is written once it is full. */
+#define OUT_BUF_SIZE (128 * 1024)
+
+/* Padding up to this many spaces is copied from spaces in one go. */
+#define SPACES_LEN (16)
+
+/* Spans up to this many chars are copied in one go too, the input buffer
+ * has that many chars of slack behind it. */
+#define SHORT_SPAN (32)
+
+/* Input is expanded in blocks of this many chars. An expander that meets
+ * chars outside ASCII leaves the rest of its block to expand_block_utf8(). */
+#define TEXT_BLOCK (4096)
+
+/* Columns whose next tab stop is looked up in a table, see struct
+ * tab_stops. */
+#define TAB_COLUMNS (4096)
+
+/* Largest tab stop of -t */
+#define MAX_TAB_STOP (INT_MAX)
+
+/* Most threads of -j */
+#define MAX_THREADS (64)
+
+/* Chars of input every thread of -j expands at a time. */
+#define CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Smallest chunk that gets a thread of its own. */
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+/* Input is searched for tabs in windows of PASS_WINDOW chars. At least
+ * PASS_MIN chars in a row without a tab are passed through by the kernel,
+ * only the rest of the windows with tabs is expanded in userspace. */
+#define PASS_WINDOW (64 * 1024)
+#define PASS_MIN (16 * 1024)
+
+/* How input without tabs gets to stdout, see select_output() */
+#define OUT_COPY (0)    /* write(2) of the mapping or the input buffer */
+#define OUT_PIPE (1)    /* splice(2) */
+#define OUT_FILE (2)    /* copy_file_range(2) from files, splice(2) from pipes,
+                         * only with MYEXPAND_IO=copy */
+
+/* What happens to blanks, see -u and -a */
+#define MODE_EXPAND (0)     /* Tabs become spaces */
+#define MODE_LEADING (1)    /* Blanks at the start of lines become tabs */
+#define MODE_ALL (2)        /* All runs of blanks become tabs */
+
+/* === Type Definitions === */
+
+/* Output that is collected and written in large writes. A buffer without
+ * a file descriptor grows instead and keeps everything. */
+struct out_buffer {
+    int fd;             /* -1 for a buffer in memory */
+    size_t len;
+    size_t size;
+    char *buf;
+};
+
+/* Tab stops of -t. Up to column end the stops are the ones of the list,
+ * behind end there is one every step columns, counted from base. The next
+ * stop behind each of the first TAB_COLUMNS columns is looked up in next,
+ * so a tab costs no division unless its line is wider than that.
+ */
+struct tab_stops {
+    size_t *list;       /* Ascending */
+    size_t count;
+    size_t end;
+    size_t base;
+    size_t step;
+    int tail;           /* '/' or '+' in front of the last value, 0 for none */
+    size_t next[TAB_COLUMNS];
+};
+
+/* A UTF-8 sequence that is cut at the end of a block of input. Its lead
+ * char is counted as one column, finish_char() corrects that once the
+ * rest of the sequence is read. */
+struct utf8_carry {
+    unsigned char bytes[4];
+    size_t len;         /* 0 if no sequence is cut */
+    size_t need;        /* Length of the whole sequence */
+};
+
+/* Position of unexpand_block() in a line. Spaces are held back until it
+ * is known whether they end at a tab stop. Like GNU unexpand, a single
+ * space in front of a tab stop only becomes a tab if more blanks follow.
+ */
+struct blank_state {
+    size_t col;
+    size_t pending;     /* Spaces held back */
+    int stop_blank;     /* The first of them ends at a tab stop */
+    int prev_blank;     /* The char before is a blank or the line starts */
+    int convert;        /* Blanks of this line still become tabs */
+    int all;            /* 1 for -a, 0 if only leading blanks count */
+};
+
+/* A part of the input that is expanded by a thread of its own, it starts
+ * at the start of a line. */
+struct chunk {
+    const char *buf;
+    size_t len;
+    const struct tab_stops *stops;
+    int mode;           /* MODE_* */
+    struct out_buffer out;
+};
+
+/* Position of the expansion inside one input buffer. Char i of the buffer
+ * is in column col + (i - line) unless there is a tab or a newline in
+ * between. Newlines are only looked for in front of tabs, so line may lag
+ * behind.
+ */
+struct scan_state {
+    struct out_buffer *out;
+    const char *buf;
+    size_t start;       /* First char that is not written yet */
+    size_t line;        /* Position of column col */
+    size_t col;
+    const struct tab_stops *stops;
+};
+
+/* Input that is passed through where it has no tabs. A file is mapped as
+ * a whole, a pipe is peeked at with tee(2) into the input buffer. The
+ * chars in front of off are written or passed through already. */
+struct source {
+    int fd;
+    const char *map;    /* The mapped file, NULL for a pipe */
+    loff_t off;
+};
+
+/* Expands the tabs of one block of input, see expand_block_scalar() */
+typedef size_t (*expand_fn)(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops);
+
+/* Finds the end of the plain text of unexpand -a, see
+ * plain_length_scalar() */
+typedef size_t (*plain_fn)(const char *buf, size_t len, int *ascii);
 
 /* === Global Variables === */
 
-/* Name of the program */
-static const char *pgm_name = "myexpand";
+/* Name of the program */
+static const char *pgm_name = "myexpand";
+
+/* Padding of short tabs */
+static const char spaces[SPACES_LEN] = "                ";
+
+/* Input buffer of expand() */
+static char in_buf[IN_BUF_SIZE + SHORT_SPAN];
+
+/* Buffered stdout */
+static char out_mem[OUT_BUF_SIZE];
+static struct out_buffer output = { STDOUT_FILENO, 0, OUT_BUF_SIZE, out_mem };
+
+/* Tab stops of -t, set up by finish_tab_stops() */
+static struct tab_stops tab_stops;
+
+/* Display widths of the chars of the Basic Multilingual Plane, two bits
+ * each, filled from charwidth.h by fill_bmp_widths() before the first
+ * char outside ASCII is counted */
+static unsigned char bmp_widths[0x10000 / 4];
+static pthread_once_t bmp_once = PTHREAD_ONCE_INIT;
+
+/* Block expander of the CPU, chosen by select_expand_block() */
+static expand_fn expand_block;
+
+/* Plain text scanner of the CPU, chosen by select_expand_block() */
+static plain_fn plain_length;
+
+/* Way to pass input through, chosen by select_output() */
+static int out_kind = OUT_COPY;
+
+/* Input is only ever read, MYEXPAND_IO=read */
+static int read_only;
+
+/* Sink of peeked pipe input that is expanded in userspace, -1 if there is
+ * none */
+static int dev_null = -1;
+
+/**
+ * @brief terminate program on program error
+ * @param exitcode exit code
+ * @param fmt format string
+ */
+static void bail_out(int exitcode, const char *fmt, ...);
+
+/**
+ * Closes all open streams.
+ * @return void
+ */
+static void cleanup(void) 
+{
+    if(fcloseall() != 0) {
+        bail_out(EXIT_FAILURE, "Not all streams could be closed.\n");
+    }
+}
+
+/**
+ * Writes all chars of a buffer, retries after short writes.
+ *
+ * @param fd The file descriptor to write to.
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @return void
+ */
+static void write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "Couldn't write to stdout.\n");
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+/**
+ * Writes everything that is collected in the output buffer.
+ *
+ * @param out The output buffer.
+ * @return void
+ */
+static void flush_output(struct out_buffer *out)
+{
+    write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+}
+
+/**
+ * Makes room in the output buffer: a buffer with a file descriptor is
+ * written, one in memory grows until len more chars fit.
+ *
+ * @param out The output buffer.
+ * @param len The number of chars that should fit.
+ * @return void
+ */
+static void make_room(struct out_buffer *out, size_t len)
+{
+    size_t size = out->size > 0 ? out->size : OUT_BUF_SIZE;
+    char *buf;
+
+    if (out->fd >= 0) {
+        flush_output(out);
+        return;
+    }
+    while (size - out->len < len) {
+        size *= 2;
+    }
+    if ((buf = realloc(out->buf, size)) == NULL) {
+        bail_out(EXIT_FAILURE, "Out of memory.\n");
+    }
+    out->buf = buf;
+    out->size = size;
+}
+
+/**
+ * Appends chars to the output buffer. Spans that don't fit into an empty
+ * buffer are written directly, without the copy. SHORT_SPAN chars behind
+ * buf have to be readable.
+ *
+ * @param out The output buffer.
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @return void
+ */
+static void put_chars(struct out_buffer *out, const char *buf, size_t len)
+{
+    /* Copy all of SHORT_SPAN, the chars behind the span are overwritten
+     * later. */
+    if (len <= SHORT_SPAN && out->len + SHORT_SPAN <= out->size) {
+        (void) memcpy(out->buf + out->len, buf, SHORT_SPAN);
+        out->len += len;
+        return;
+    }
+    if (out->len + len > out->size) {
+        make_room(out, len);
+        if (out->fd >= 0 && len >= out->size) {
+            write_all(out->fd, buf, len);
+            return;
+        }
+    }
+    (void) memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+}
+
+/**
+ * Appends spaces to the output buffer.
+ *
+ * @param out The output buffer.
+ * @param count The number of spaces.
+ * @return void
+ */
+static void put_spaces(struct out_buffer *out, size_t count)
+{
+    /* Copy all of spaces, the chars behind the padding are overwritten
+     * later. */
+    if (count <= SPACES_LEN && out->len + SPACES_LEN <= out->size) {
+        (void) memcpy(out->buf + out->len, spaces, SPACES_LEN);
+        out->len += count;
+        return;
+    }
+    while (count > 0) {
+        size_t n;
+
+        if (out->len == out->size) {
+            make_room(out, count);
+        }
+        n = out->size - out->len < count ? out->size - out->len : count;
+        (void) memset(out->buf + out->len, ' ', n);
+        out->len += n;
+        count -= n;
+    }
+}
+
+/**
+ * Appends one char to the output buffer.
+ *
+ * @param out The output buffer.
+ * @param c The char.
+ * @return void
+ */
+static void put_char(struct out_buffer *out, char c)
+{
+    if (out->len == out->size) {
+        make_room(out, 1);
+    }
+    out->buf[out->len++] = c;
+}
+
+/**
+ * Returns the tab stop behind a column without the table.
+ *
+ * @param stops The tab stops.
+ * @param col The column.
+ * @return The column of the next tab stop.
+ */
+static size_t far_stop(const struct tab_stops *stops, size_t col)
+{
+    size_t lo = 0, hi = stops->count;
+
+    if (col >= stops->end) {
+        return stops->base
+            + stops->step * ((col - stops->base) / stops->step + 1);
+    }
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (stops->list[mid] <= col) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return stops->list[lo];
+}
+
+/**
+ * Returns the tab stop behind a column.
+ *
+ * @param stops The tab stops.
+ * @param col The column.
+ * @return The column of the next tab stop.
+ */
+static inline size_t next_stop(const struct tab_stops *stops, size_t col)
+{
+    return col < TAB_COLUMNS ? stops->next[col] : far_stop(stops, col);
+}
+
+/**
+ * Returns the length of the UTF-8 sequence a lead char starts.
+ *
+ * @param c The lead char.
+ * @return 2 to 4, 0 if c can't start a sequence.
+ */
+static inline size_t utf8_length(unsigned char c)
+{
+    if (c < 0xC2) {
+        return 0;
+    }
+
+    return c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+}
+
+/**
+ * Decodes one UTF-8 sequence. Overlong forms, surrogates and sequences
+ * that are cut off are not decoded.
+ *
+ * @param s The chars of the sequence.
+ * @param len The number of chars that may be looked at.
+ * @param cp The code point of the sequence.
+ * @return The length of the sequence, 0 if it is not valid.
+ */
+static inline size_t decode_utf8(const unsigned char *s, size_t len,
+    uint32_t *cp)
+{
+    static const uint32_t min_cp[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    size_t n = utf8_length(s[0]), i;
+    uint32_t c;
+
+    if (n == 0 || n > len) {
+        return 0;
+    }
+    c = s[0] & (0x7F >> n);
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    if (c < min_cp[n] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        return 0;
+    }
+    *cp = c;
+
+    return n;
+}
+
+/**
+ * Looks a code point up in a table of charwidth.h.
+ *
+ * @param table The sorted ranges.
+ * @param count The number of ranges.
+ * @param cp The code point.
+ * @return 1 if a range holds cp, 0 otherwise.
+ */
+static int in_table(const struct char_range *table, size_t count,
+    uint32_t cp)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (table[mid].last < cp) {
+            lo = mid + 1;
+        } else if (table[mid].first > cp) {
+            hi = mid;
+        } else {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Sets the widths of a table of charwidth.h in bmp_widths.
+ *
+ * @param table The ranges.
+ * @param count The number of ranges.
+ * @param width The width of the chars in the ranges.
+ * @return void
+ */
+static void set_bmp_widths(const struct char_range *table, size_t count,
+    unsigned width)
+{
+    size_t i;
+    uint32_t cp;
+
+    for (i = 0; i < count && table[i].first < 0x10000; i++) {
+        uint32_t last = table[i].last < 0xFFFF ? table[i].last : 0xFFFF;
+
+        for (cp = table[i].first; cp <= last; cp++) {
+            unsigned shift = (cp & 3) * 2;
+
+            /* Whole bytes at a time inside the range */
+            if (shift == 0 && last - cp >= 3) {
+                bmp_widths[cp >> 2] = (unsigned char) (width * 0x55);
+                cp += 3;
+                continue;
+            }
+            bmp_widths[cp >> 2] = (unsigned char)
+                ((bmp_widths[cp >> 2] & ~(3u << shift)) | width << shift);
+        }
+    }
+}
+
+/**
+ * Fills bmp_widths, run once through bmp_once.
+ *
+ * @return void
+ */
+static void fill_bmp_widths(void)
+{
+    /* 0x55 sets all four chars of a byte to one column */
+    (void) memset(bmp_widths, 0x55, sizeof(bmp_widths));
+    set_bmp_widths(zero_width, sizeof(zero_width) / sizeof(zero_width[0]),
+        0);
+    set_bmp_widths(double_width,
+        sizeof(double_width) / sizeof(double_width[0]), 2);
+}
+
+/**
+ * Returns the number of columns a char takes on a terminal. Chars of the
+ * Basic Multilingual Plane are looked up in bmp_widths, which has to be
+ * filled, the others in the tables of charwidth.h.
+ *
+ * @param cp The code point of the char.
+ * @return 0, 1 or 2.
+ */
+static inline size_t char_width(uint32_t cp)
+{
+    if (cp < 0x10000) {
+        return (bmp_widths[cp >> 2] >> (cp & 3) * 2) & 3;
+    }
+    if (in_table(zero_width, sizeof(zero_width) / sizeof(zero_width[0]),
+        cp)) {
+        return 0;
+    }
+
+    return in_table(double_width,
+        sizeof(double_width) / sizeof(double_width[0]), cp) ? 2 : 1;
+}
+
+/**
+ * Returns the number of columns UTF-8 text without tabs and newlines
+ * takes. A valid sequence takes the columns of its char. A char that
+ * starts no valid sequence takes one column unless it continues one, the
+ * continuation chars of a sequence take none. So the text takes a column
+ * per char that is no continuation char, only sequences of chars from
+ * U+0300 on (lead chars from 0xCC on) are decoded to correct that.
+ *
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @return The number of columns.
+ */
+static size_t text_width(const char *buf, size_t len)
+{
+    const unsigned char *s = (const unsigned char *) buf;
+    size_t width = 0, i = 0, n;
+    uint32_t cp;
+
+    (void) pthread_once(&bmp_once, fill_bmp_widths);
+    while (i < len) {
+        uint64_t word;
+
+        /* Runs of ASCII go eight chars at a time */
+        if (i + 8 <= len) {
+            (void) memcpy(&word, s + i, 8);
+            if ((word & UINT64_C(0x8080808080808080)) == 0) {
+                width += 8;
+                i += 8;
+                continue;
+            }
+        }
+        width += (s[i] & 0xC0) != 0x80;
+        if (s[i] >= 0xCC && (n = decode_utf8(s + i, len - i, &cp)) != 0) {
+            width = width - 1 + char_width(cp);
+            i += n;
+        } else {
+            i++;
+        }
+    }
+
+    return width;
+}
+
+/**
+ * Checks whether a block of input is ASCII only. Eight or 64 chars are
+ * or-ed together at a time, only the high bits of the result count.
+ *
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @return 1 if no char has its high bit set, 0 otherwise.
+ */
+static int is_ascii(const char *buf, size_t len)
+{
+    uint64_t high = 0, word;
+    size_t i = 0;
+
+#if defined(HAVE_X86_SIMD) && defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i + 64 <= len; i += 64) {
+        acc = _mm_or_si128(acc, _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *) (buf + i)),
+                _mm_loadu_si128((const __m128i *) (buf + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *) (buf + i + 32)),
+                _mm_loadu_si128((const __m128i *) (buf + i + 48)))));
+    }
+    if (_mm_movemask_epi8(acc) != 0) {
+        return 0;
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        (void) memcpy(&word, buf + i, 8);
+        high |= word;
+    }
+    for (; i < len; i++) {
+        high |= (unsigned char) buf[i];
+    }
+
+    return (high & UINT64_C(0x8080808080808080)) == 0;
+}
+
+/**
+ * Expands the tabs of a block of input that is not ASCII only. Its spans
+ * are short as a rule, so the columns are counted in the same pass that
+ * looks for tabs and newlines, see text_width() for the widths. The chars
+ * go eight at a time: the high bits of a word mark its tabs, newlines and
+ * lead chars from 0xCC on, all chars in front of the first mark take a
+ * column unless they are continuation chars.
+ *
+ * @param out The output buffer.
+ * @param buf The chars of the block.
+ * @param len The number of chars.
+ * @param col The column of the first char of the block.
+ * @param stops The tab stops.
+ * @return The column of the char after the block.
+ */
+HOT_CLONES
+static size_t expand_block_utf8(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    const uint64_t highs = UINT64_C(0x8080808080808080);
+    const unsigned char *s = (const unsigned char *) buf;
+    size_t start = 0, i = 0, n;
+    uint32_t cp;
+
+    (void) pthread_once(&bmp_once, fill_bmp_widths);
+    while (i < len) {
+        unsigned char c;
+
+        if (i + 8 <= len) {
+            uint64_t word, tab, nl, marks, cont;
+
+            (void) memcpy(&word, s + i, 8);
+            tab = word ^ ones * '\t';
+            nl = word ^ ones * '\n';
+            /* Zero bytes of tab and nl, chars from 0xCC on */
+            marks = (((tab - ones) & ~tab) | ((nl - ones) & ~nl)
+                | (((word & ~highs) + ones * 0x34) & word)) & highs;
+            /* Chars from 0x80 to 0xBF */
+            cont = word & ~(word << 1) & highs;
+            n = 8;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            /* The lowest mark is exact, the chars in front of it are not
+             * marked */
+            if (marks != 0) {
+                n = (size_t) __builtin_ctzll(marks) / 8;
+                cont &= (UINT64_C(1) << (8 * n)) - 1;
+            }
+#else
+            if (marks != 0) {
+                n = 0;
+                cont = 0;
+            }
+#endif
+            col += n - (size_t) (((cont >> 7) * ones) >> 56);
+            i += n;
+            if (n == 8) {
+                continue;
+            }
+        }
+        c = s[i];
+        if (c == '\t') {
+            size_t next = next_stop(stops, col);
+
+            put_chars(out, buf + start, i - start);
+            put_spaces(out, next - col);
+            col = next;
+            start = i + 1;
+        } else if (c == '\n') {
+            col = 0;
+        } else if (c >= 0xCC && (n = decode_utf8(s + i, len - i, &cp)) != 0) {
+            /* Text in other scripts has runs of them */
+            do {
+                col += char_width(cp);
+                i += n;
+            } while (i < len && s[i] >= 0xCC
+                && (n = decode_utf8(s + i, len - i, &cp)) != 0);
+            continue;
+        } else {
+            col += (c & 0xC0) != 0x80;
+        }
+        i++;
+    }
+    put_chars(out, buf + start, len - start);
+
+    return col;
+}
+
+/**
+ * Expands the tabs of one block of input.
+ *
+ * Only tabs need work, so the block is cut at every tab: the plain span in
+ * front of it is copied as a whole, the column at the tab is counted from
+ * the last newline of the span (or continues from the previous span if the
+ * span has none) and the padding is appended in one go. Portable version,
+ * memchr() and memrchr() do the search. A block that is not ASCII only
+ * goes to expand_block_utf8().
+ *
+ * @param out The output buffer.
+ * @param buf The chars of the block.
+ * @param len The number of chars.
+ * @param col The column of the first char of the block.
+ * @param stops The tab stops.
+ * @return The column of the char after the block.
+ */
+static size_t expand_block_scalar(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    if (!is_ascii(buf, len)) {
+        return expand_block_utf8(out, buf, len, col, stops);
+    }
+    while (len > 0) {
+        const char *tab = memchr(buf, '\t', len);
+        size_t span = tab != NULL ? (size_t) (tab - buf) : len;
+        const char *nl = memrchr(buf, '\n', span);
+        size_t next;
+
+        put_chars(out, buf, span);
+        col = nl != NULL ? (size_t) (buf + span - nl - 1) : col + span;
+        if (tab == NULL) {
+            break;
+        }
+
+        /* Insert spaces up to the next tab stop. */
+        next = next_stop(stops, col);
+        put_spaces(out, next - col);
+        col = next;
+        buf += span + 1;
+        len -= span + 1;
+    }
+
+    return col;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * Writes the span in front of a tab and the padding of the tab.
+ *
+ * @param s The scan state.
+ * @param pos The position of the tab in the buffer.
+ * @return void
+ */
+static void expand_tab(struct scan_state *s, size_t pos)
+{
+    size_t col = s->col + (pos - s->line);
+    size_t next = next_stop(s->stops, col);
+
+    put_chars(s->out, s->buf + s->start, pos - s->start);
+    put_spaces(s->out, next - col);
+    s->start = pos + 1;
+    s->line = pos + 1;
+    s->col = next;
+}
+
+/**
+ * Moves the start of the line to the last newline in front of a position.
+ *
+ * @param s The scan state.
+ * @param pos The position in the buffer.
+ * @return void
+ */
+static void sync_line(struct scan_state *s, size_t pos)
+{
+    const char *nl;
+
+    if (s->line < pos
+        && (nl = memrchr(s->buf + s->line, '\n', pos - s->line)) != NULL) {
+        s->line = (size_t) (nl - s->buf) + 1;
+        s->col = 0;
+    }
+}
+
+/**
+ * Expands the tabs of 64 chars, walking their bit mask with tzcnt. The
+ * column of each tab comes from the last newline in front of it.
+ *
+ * @param s The scan state.
+ * @param base The position of the first of the chars in the buffer.
+ * @param tabs Bit i is set if char base + i is a tab.
+ * @param nls Bit i is set if char base + i is a newline.
+ * @return void
+ */
+HOT_CLONES
+static void walk_masks(struct scan_state *s, size_t base, uint64_t tabs,
+    uint64_t nls)
+{
+    sync_line(s, base);
+    while (tabs != 0) {
+        int i = __builtin_ctzll(tabs);
+        uint64_t before = nls & (((uint64_t) 1 << i) - 1);
+
+        if (before != 0) {
+            s->line = base + 64 - (size_t) __builtin_clzll(before);
+            s->col = 0;
+            nls &= ~before;
+        }
+        expand_tab(s, base + (size_t) i);
+        tabs &= tabs - 1;
+    }
+}
+
+/**
+ * Writes the chars in front of the first chars that are not ASCII and
+ * expands the rest of the buffer with expand_block_utf8().
+ *
+ * @param s The scan state.
+ * @param pos The position of the first char that is not scanned yet, all
+ * chars in front of it are ASCII.
+ * @param len The number of chars in the buffer.
+ * @return The column of the char after the buffer.
+ */
+static size_t leave_ascii(struct scan_state *s, size_t pos, size_t len)
+{
+    sync_line(s, pos);
+    put_chars(s->out, s->buf + s->start, pos - s->start);
+
+    return expand_block_utf8(s->out, s->buf + pos, len - pos,
+        s->col + (pos - s->line), s->stops);
+}
+
+/**
+ * Handles the chars of a buffer that don't fill 64 chars any more and
+ * writes the rest of the buffer.
+ *
+ * @param s The scan state.
+ * @param base The position of the first char that is not scanned yet.
+ * @param len The number of chars in the buffer.
+ * @return The column of the char after the buffer.
+ */
+static size_t finish_scan(struct scan_state *s, size_t base, size_t len)
+{
+    uint64_t tabs = 0, nls = 0;
+    unsigned high = 0;
+    size_t i;
+
+    for (i = base; i < len; i++) {
+        tabs |= (uint64_t) (s->buf[i] == '\t') << (i - base);
+        nls |= (uint64_t) (s->buf[i] == '\n') << (i - base);
+        high |= (unsigned char) s->buf[i];
+    }
+    if (high >= 0x80) {
+        return leave_ascii(s, base, len);
+    }
+    if (tabs != 0) {
+        walk_masks(s, base, tabs, nls);
+    }
+    sync_line(s, len);
+    put_chars(s->out, s->buf + s->start, len - s->start);
+
+    return s->col + (len - s->line);
+}
+
+/**
+ * SSE2 and AVX2 versions of expand_block_scalar(). Every 64 chars are
+ * compared with tab 16 or 32 at a time, the movemasks of the comparisons
+ * give the bit mask of the tabs. Only if there is a tab the newlines get a
+ * mask too. Chars without a tab are copied with the span in front of the
+ * next tab. The chars themselves are or-ed into the test for tabs, so the
+ * first 64 chars with one outside ASCII hand the rest of the block over
+ * to expand_block_utf8() at no extra branch.
+ */
+__attribute__((target("sse2")))
+static size_t expand_block_sse2(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    struct scan_state s = { out, buf, 0, 0, col, stops };
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i;
+    int k;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m128i v[4], t[4];
+        uint64_t tabs = 0, nls = 0;
+
+        for (k = 0; k < 4; k++) {
+            v[k] = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+            t[k] = _mm_cmpeq_epi8(v[k], tab);
+        }
+        if (_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_or_si128(t[0], t[1]), _mm_or_si128(t[2], t[3])),
+            _mm_or_si128(_mm_or_si128(v[0], v[1]),
+                _mm_or_si128(v[2], v[3])))) != 0) {
+            if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(v[0], v[1]),
+                _mm_or_si128(v[2], v[3]))) != 0) {
+                return leave_ascii(&s, i, len);
+            }
+            for (k = 0; k < 4; k++) {
+                tabs |= (uint64_t) (unsigned) _mm_movemask_epi8(t[k])
+                    << (16 * k);
+                nls |= (uint64_t) (unsigned) _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v[k], nl)) << (16 * k);
+            }
+            walk_masks(&s, i, tabs, nls);
+        }
+    }
+
+    return finish_scan(&s, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t expand_block_avx2(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    struct scan_state s = { out, buf, 0, 0, col, stops };
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i high = _mm256_set1_epi8((char) 0x80);
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+        __m256i tab_lo = _mm256_cmpeq_epi8(lo, tab);
+        __m256i tab_hi = _mm256_cmpeq_epi8(hi, tab);
+        __m256i text = _mm256_or_si256(lo, hi);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(tab_lo, tab_hi), text);
+
+        if (!_mm256_testz_si256(any, high)) {
+            if (!_mm256_testz_si256(text, high)) {
+                return leave_ascii(&s, i, len);
+            }
+            uint64_t tabs = (uint32_t) _mm256_movemask_epi8(tab_lo)
+                | (uint64_t) (uint32_t) _mm256_movemask_epi8(tab_hi) << 32;
+            uint64_t nls = (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(lo, nl))
+                | (uint64_t) (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(hi, nl)) << 32;
+
+            walk_masks(&s, i, tabs, nls);
+        }
+    }
+
+    return finish_scan(&s, i, len);
+}
+
+#endif
+
+/**
+ * Returns the length of the plain text at the start of a buffer, the
+ * chars in front of the first tab, newline or space that is followed by a
+ * blank. A space at the end of the buffer ends it too, the char behind it
+ * is not known yet. Single spaces between other chars come out as they
+ * are, so only the chars behind the plain text need a look. Portable
+ * version, the chars go eight at a time like in expand_block_utf8() but
+ * with every byte of a word tested exactly. A space is marked by the blank
+ * behind it.
+ *
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @param ascii Set to 1 if the plain text is ASCII only, 0 otherwise.
+ * @return The number of chars of the plain text.
+ */
+static size_t plain_length_scalar(const char *buf, size_t len, int *ascii)
+{
+    const unsigned char *s = (const unsigned char *) buf;
+    uint64_t high = 0;
+    size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    const uint64_t highs = UINT64_C(0x8080808080808080);
+    const uint64_t lows = UINT64_C(0x7F7F7F7F7F7F7F7F);
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word, sp, tab, nl, next, marks;
+
+        (void) memcpy(&word, s + i, 8);
+        sp = word ^ ones * ' ';
+        tab = word ^ ones * '\t';
+        nl = word ^ ones * '\n';
+        /* The high bit of every zero byte */
+        sp = ~(((sp & lows) + lows) | sp) & highs;
+        tab = ~(((tab & lows) + lows) | tab) & highs;
+        nl = ~(((nl & lows) + lows) | nl) & highs;
+        /* Blanks one char further on, the last one behind the word */
+        next = (sp | tab) >> 8;
+        if (i + 8 == len || s[i + 8] == ' ' || s[i + 8] == '\t') {
+            next |= UINT64_C(1) << 63;
+        }
+        marks = tab | nl | (sp & next);
+        if (marks != 0) {
+            size_t n = (size_t) __builtin_ctzll(marks) / 8;
+
+            high |= word & ((UINT64_C(1) << (8 * n)) - 1);
+            *ascii = (high & highs) == 0;
+            return i + n;
+        }
+        high |= word;
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char c = s[i];
+
+        if (c == '\t' || c == '\n' || (c == ' ' && (i + 1 == len
+            || s[i + 1] == ' ' || s[i + 1] == '\t'))) {
+            break;
+        }
+        high |= c;
+    }
+    *ascii = (high & UINT64_C(0x8080808080808080)) == 0;
+
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSE2 and AVX2 versions of plain_length_scalar(). The chars are compared
+ * with space, tab and newline 16 or 32 at a time, the movemasks of the
+ * spaces and tabs shifted by one char give the blanks behind the spaces.
+ * The rest of the buffer that doesn't fill a vector goes to
+ * plain_length_scalar().
+ */
+__attribute__((target("sse2")))
+static size_t plain_length_sse2(const char *buf, size_t len, int *ascii)
+{
+    const unsigned char *s = (const unsigned char *) buf;
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    unsigned high = 0;
+    size_t i, n;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        unsigned sp = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, space));
+        unsigned tb = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, tab));
+        unsigned marks = tb
+            | (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        unsigned wide = (unsigned) _mm_movemask_epi8(v);
+        unsigned next = (sp | tb) >> 1;
+
+        if (i + 16 == len || s[i + 16] == ' ' || s[i + 16] == '\t') {
+            next |= 0x8000;
+        }
+        marks |= sp & next;
+        if (marks != 0) {
+            n = (size_t) __builtin_ctz(marks);
+            *ascii = high == 0 && (wide & ((1U << n) - 1)) == 0;
+            return i + n;
+        }
+        high |= wide;
+    }
+    n = plain_length_scalar(buf + i, len - i, ascii);
+    *ascii = *ascii && high == 0;
+
+    return i + n;
+}
+
+__attribute__((target("avx2")))
+static size_t plain_length_avx2(const char *buf, size_t len, int *ascii)
+{
+    const unsigned char *s = (const unsigned char *) buf;
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    uint32_t high = 0;
+    size_t i, n;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        uint32_t sp = (uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, space));
+        uint32_t tb = (uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, tab));
+        uint32_t marks = tb | (uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, nl));
+        uint32_t wide = (uint32_t) _mm256_movemask_epi8(v);
+        uint32_t next = (sp | tb) >> 1;
+
+        if (i + 32 == len || s[i + 32] == ' ' || s[i + 32] == '\t') {
+            next |= UINT32_C(0x80000000);
+        }
+        marks |= sp & next;
+        if (marks != 0) {
+            n = (size_t) __builtin_ctz(marks);
+            *ascii = high == 0 && (wide & ((UINT32_C(1) << n) - 1)) == 0;
+            return i + n;
+        }
+        high |= wide;
+    }
+    n = plain_length_scalar(buf + i, len - i, ascii);
+    *ascii = *ascii && high == 0;
+
+    return i + n;
+}
+
+#endif
+
+/**
+ * Chooses the block expander and the plain text scanner of unexpand -a by
+ * the CPU features. The environment variable MYEXPAND_SIMD (scalar, sse2,
+ * avx2) can force a lower one.
+ *
+ * @return void
+ */
+static void select_expand_block(void)
+{
+    const char *force = getenv("MYEXPAND_SIMD");
+    int level = 2; /* 0 scalar, 1 sse2, 2 avx2 */
+
+    expand_block = expand_block_scalar;
+    plain_length = plain_length_scalar;
+
+    if (force != NULL) {
+        if (strcmp(force, "scalar") == 0) {
+            level = 0;
+        } else if (strcmp(force, "sse2") == 0) {
+            level = 1;
+        }
+    }
+
+#ifdef HAVE_X86_SIMD
+    {
+        unsigned int eax, ebx, ecx, edx, xcr0 = 0;
+
+        if (level < 1 || __get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+            return;
+        }
+        if ((edx & bit_SSE2) != 0) {
+            expand_block = expand_block_sse2;
+            plain_length = plain_length_sse2;
+        }
+
+        /* The OS has to save the ymm registers too, ask XGETBV */
+        if ((ecx & bit_OSXSAVE) != 0) {
+            __asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+        }
+        if (level < 2 || (xcr0 & 0x06) != 0x06 || (ecx & bit_AVX) == 0
+            || __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+            return;
+        }
+        if ((ebx & bit_AVX2) != 0) {
+            expand_block = expand_block_avx2;
+            plain_length = plain_length_avx2;
+        }
+    }
+#endif
+}
+
+/**
+ * Moves the end of a part of the input back to the start of a UTF-8
+ * sequence that the part would cut.
+ *
+ * @param buf The input, the char at buf[len] has to be readable.
+ * @param len The length of the part.
+ * @return The new length, at most 3 chars shorter. It is 0 only if len
+ * is less than 4.
+ */
+static size_t char_boundary(const char *buf, size_t len)
+{
+    size_t n = len;
+
+    while (n > 0 && len - n < 3 && ((unsigned char) buf[n] & 0xC0) == 0x80) {
+        n--;
+    }
+
+    return ((unsigned char) buf[n] & 0xC0) == 0x80 ? len : n;
+}
+
+/**
+ * Expands the tabs of a part of the input in blocks of TEXT_BLOCK chars,
+ * so text after chars outside ASCII gets back to the fast path of the
+ * expander of the CPU soon. Blocks only end inside a UTF-8 sequence where
+ * the part does.
+ *
+ * @param out The output buffer.
+ * @param buf The chars of the part.
+ * @param len The number of chars.
+ * @param col The column of the first char.
+ * @param stops The tab stops.
+ * @return The column of the char after the part.
+ */
+static size_t expand_text(struct out_buffer *out, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    while (len > 0) {
+        size_t n = len > TEXT_BLOCK ? char_boundary(buf, TEXT_BLOCK) : len;
+
+        col = expand_block(out, buf, n, col, stops);
+        buf += n;
+        len -= n;
+    }
+
+    return col;
+}
+
+/**
+ * Corrects the column of a UTF-8 sequence that was cut at the end of the
+ * last block with the continuation chars at the start of the next one.
+ *
+ * @param carry The cut sequence.
+ * @param buf The chars of the next block.
+ * @param len The number of chars.
+ * @param col The column of the first char of the block.
+ * @return The corrected column.
+ */
+static size_t finish_char(struct utf8_carry *carry, const char *buf,
+    size_t len, size_t col)
+{
+    size_t i = 0;
+    uint32_t cp;
+
+    while (carry->len > 0 && carry->len < carry->need && i < len
+        && ((unsigned char) buf[i] & 0xC0) == 0x80) {
+        carry->bytes[carry->len++] = (unsigned char) buf[i++];
+    }
+    if (carry->len == 0 || (carry->len < carry->need && i == len)) {
+        return col;
+    }
+    /* The lead char was counted as one column */
+    if (decode_utf8(carry->bytes, carry->len, &cp) != 0) {
+        (void) pthread_once(&bmp_once, fill_bmp_widths);
+        col = col - 1 + char_width(cp);
+    }
+    carry->len = 0;
+
+    return col;
+}
+
+/**
+ * Keeps a UTF-8 sequence that is cut at the end of a block for
+ * finish_char(). A sequence that is still waiting for more continuation
+ * chars stays.
+ *
+ * @param carry The cut sequence.
+ * @param buf The chars of the block.
+ * @param len The number of chars.
+ * @return void
+ */
+static void keep_tail(struct utf8_carry *carry, const char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 1; carry->len == 0 && i <= 3 && i <= len; i++) {
+        unsigned char c = (unsigned char) buf[len - i];
+
+        if ((c & 0xC0) != 0x80) {
+            if (utf8_length(c) > i) {
+                (void) memcpy(carry->bytes, buf + len - i, i);
+                carry->len = i;
+                carry->need = utf8_length(c);
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Expands tabs to spaces, reading the input into in_buf.
+ *
+ * @param fd The file descriptor of the input.
+ * @param stops The tab stops.
+ * @return void
+ */
+static void expand_read(int fd, const struct tab_stops *stops)
+{
+    /* col Current index in line. */
+    size_t col = 0;
+    struct utf8_carry carry = { { 0 }, 0, 0 };
+    ssize_t n;
+
+    while ((n = read(fd, in_buf, IN_BUF_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        col = finish_char(&carry, in_buf, (size_t) n, col);
+        col = expand_text(&output, in_buf, (size_t) n, col, stops);
+        keep_tail(&carry, in_buf, (size_t) n);
+    }
+}
+
+/**
+ * Returns the length of the run of spaces at the start of a buffer. The
+ * first char that is no space is found with one test per eight chars, the
+ * runs are short and of any length.
+ *
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @return The number of spaces.
+ */
+static inline size_t space_run(const char *buf, size_t len)
+{
+    size_t n = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n + 8 <= len; n += 8) {
+        uint64_t word;
+
+        (void) memcpy(&word, buf + n, 8);
+        word ^= UINT64_C(0x2020202020202020);
+        if (word != 0) {
+            return n + (size_t) __builtin_ctzll(word) / 8;
+        }
+    }
+#endif
+    while (n < len && buf[n] == ' ') {
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Sets the state of unexpand_block() to the start of a line.
+ *
+ * @param u The state.
+ * @return void
+ */
+static void start_line(struct blank_state *u)
+{
+    u->col = 0;
+    u->prev_blank = 1;
+    u->convert = 1;
+}
+
+/**
+ * Writes the spaces that are held back, when the char behind them is no
+ * blank or the line stops being converted. A single space in front of a
+ * tab stop becomes a tab only if it has company.
+ *
+ * @param out The output buffer.
+ * @param u The state.
+ * @return void
+ */
+static void put_blanks(struct out_buffer *out, struct blank_state *u)
+{
+    if (u->pending == 0) {
+        return;
+    }
+    if (u->stop_blank && u->pending > 1) {
+        put_char(out, '\t');
+        u->pending--;
+    }
+    put_spaces(out, u->pending);
+    u->pending = 0;
+    u->stop_blank = 0;
+}
+
+/**
+ * Converts a run of spaces of a line. Spaces are held back until one
+ * reaches a tab stop right behind another blank, then it and the held back
+ * spaces become a tab. The stops inside the run are walked, so a run
+ * costs one lookup per stop, not one per space.
+ *
+ * @param out The output buffer.
+ * @param u The state.
+ * @param count The number of spaces.
+ * @param stops The tab stops.
+ * @return void
+ */
+static void unexpand_spaces(struct out_buffer *out, struct blank_state *u,
+    size_t count, const struct tab_stops *stops)
+{
+    size_t end = u->col + count, next;
+
+    while ((next = next_stop(stops, u->col)) <= end) {
+        if (!u->prev_blank && next == u->col + 1) {
+            /* A single space behind a non-blank waits for company */
+            u->stop_blank = 1;
+            u->pending = 1;
+        } else {
+            /* The space in front of the stop before gets a tab of its
+             * own */
+            if (u->stop_blank) {
+                put_char(out, '\t');
+            }
+            put_char(out, '\t');
+            u->pending = 0;
+            u->stop_blank = 0;
+        }
+        u->col = next;
+        u->prev_blank = 1;
+    }
+    u->pending += end - u->col;
+    u->col = end;
+    u->prev_blank = 1;
+}
+
+/**
+ * Converts a tab of a line, it swallows the spaces that are held back.
+ *
+ * @param out The output buffer.
+ * @param u The state.
+ * @param stops The tab stops.
+ * @return void
+ */
+static void unexpand_tab(struct out_buffer *out, struct blank_state *u,
+    const struct tab_stops *stops)
+{
+    if (u->stop_blank) {
+        put_char(out, '\t');
+    }
+    put_char(out, '\t');
+    u->col = next_stop(stops, u->col);
+    u->pending = 0;
+    u->stop_blank = 0;
+    u->prev_blank = 1;
+}
+
+/**
+ * Converts the blanks of one block of input to tabs where they end at tab
+ * stops (-u, -a). Lines whose blanks don't count any more are copied up
+ * to the next newline with memchr(), so are the lines behind the last stop
+ * of a list without '/' or '+'. With -a the plain text between runs of
+ * blanks is skipped with plain_length() and only its columns are counted,
+ * see text_width(). Runs of spaces are measured with space_run() and
+ * converted as a whole. The state goes on in the next block.
+ *
+ * @param out The output buffer.
+ * @param buf The chars of the block.
+ * @param len The number of chars.
+ * @param u The state at the first char of the block.
+ * @param stops The tab stops.
+ * @return void
+ */
+static void unexpand_block(struct out_buffer *out, const char *buf,
+    size_t len, struct blank_state *u, const struct tab_stops *stops)
+{
+    /* A list without '/' or '+' has a last stop */
+    int last = stops->count > 0 && stops->tail == 0, ascii;
+    size_t start = 0, i = 0, n;
+    const char *nl;
+
+    while (i < len) {
+        char c = buf[i];
+
+        if (!u->convert) {
+            if ((nl = memchr(buf + i, '\n', len - i)) == NULL) {
+                break;
+            }
+            i = (size_t) (nl - buf) + 1;
+            start_line(u);
+            continue;
+        }
+        if (c == ' ' || c == '\t') {
+            put_chars(out, buf + start, i - start);
+            start = i;
+            if (last && u->col >= stops->end) {
+                /* Behind the last stop of the list the rest of the line
+                 * stays as it is */
+                put_blanks(out, u);
+                u->convert = 0;
+                continue;
+            }
+            if (c == '\t') {
+                unexpand_tab(out, u, stops);
+                n = 1;
+            } else {
+                n = space_run(buf + i, len - i);
+                if (last && n > stops->end - u->col) {
+                    n = stops->end - u->col;
+                }
+                unexpand_spaces(out, u, n, stops);
+            }
+            i += n;
+            start = i;
+            continue;
+        }
+        put_blanks(out, u);
+        if (c == '\n') {
+            start_line(u);
+            i++;
+            continue;
+        }
+        u->prev_blank = 0;
+        u->convert = u->all;
+        if (u->all) {
+            n = plain_length(buf + i, len - i, &ascii);
+            u->col += ascii ? n : text_width(buf + i, n);
+            i += n;
+        }
+    }
+    put_chars(out, buf + start, len - start);
+}
 
 /**
- * @brief terminate program on program error
- * @param exitcode exit code
- * @param fmt format string
+ * Converts the blanks of a part of the input that starts at the start of
+ * a line and ends at the end of one or of the input.
+ *
+ * @param out The output buffer.
+ * @param buf The chars of the part.
+ * @param len The number of chars.
+ * @param stops The tab stops.
+ * @param all 1 for -a, 0 for -u.
+ * @return void
  */
-static void bail_out(int exitcode, const char *fmt, ...);
+static void unexpand_text(struct out_buffer *out, const char *buf,
+    size_t len, const struct tab_stops *stops, int all)
+{
+    struct blank_state u = { 0, 0, 0, 0, 0, all };
+
+    start_line(&u);
+    unexpand_block(out, buf, len, &u, stops);
+    put_blanks(out, &u);
+}
 
 /**
- * Closes all open streams.
+ * Converts blanks to tabs (-u, -a), reading the input into in_buf.
+ *
+ * @param fd The file descriptor of the input.
+ * @param stops The tab stops.
+ * @param all 1 for -a, 0 for -u.
  * @return void
  */
-static void cleanup(void) 
+static void unexpand(int fd, const struct tab_stops *stops, int all)
 {
-    if(fcloseall() != 0) {
-        bail_out(EXIT_FAILURE, "Not all streams could be closed.\n");
+    struct blank_state u = { 0, 0, 0, 0, 0, all };
+    struct utf8_carry carry = { { 0 }, 0, 0 };
+    ssize_t n;
+
+    start_line(&u);
+    while ((n = read(fd, in_buf, IN_BUF_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        u.col = finish_char(&carry, in_buf, (size_t) n, u.col);
+        unexpand_block(&output, in_buf, (size_t) n, &u, stops);
+        keep_tail(&carry, in_buf, (size_t) n);
+    }
+    put_blanks(&output, &u);
+}
+
+/**
+ * Reads until a buffer is full or the input ends.
+ *
+ * @param fd The file descriptor of the input.
+ * @param buf The buffer.
+ * @param len The size of the buffer.
+ * @return The number of chars read, less than len at the end.
+ */
+static size_t read_fully(int fd, char *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t) n;
+    }
+
+    return done;
+}
+
+/**
+ * Writes the outputs of the chunks in order, retries after short writes.
+ *
+ * @param iov The outputs of the chunks.
+ * @param count The number of chunks.
+ * @return void
+ */
+static void write_chunks(struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bail_out(EXIT_FAILURE, "Couldn't write to stdout.\n");
+        }
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
     }
 }
 
 /**
- * Expands tabs to spaces.
+ * Expands one chunk into its own output buffer, or converts its blanks
+ * with -u and -a, started as a thread.
  *
- * @param fp The pointer to the input stream.
- * @param tabstop Position where the tab should end.
+ * @param arg The chunk.
+ * @return NULL
+ */
+static void *expand_chunk(void *arg)
+{
+    struct chunk *c = arg;
+
+    /* Most chars come out as they are, start with room for all of them */
+    c->out.len = 0;
+    if (c->out.size < c->len + SHORT_SPAN) {
+        make_room(&c->out, c->len + SHORT_SPAN);
+    }
+    if (c->mode == MODE_EXPAND) {
+        (void) expand_text(&c->out, c->buf, c->len, 0, c->stops);
+    } else {
+        unexpand_text(&c->out, c->buf, c->len, c->stops,
+            c->mode == MODE_ALL);
+    }
+
+    return NULL;
+}
+
+/**
+ * Expands whole lines with several threads. The lines are cut into one
+ * chunk per thread at newlines, so every chunk starts in column 0. The
+ * outputs of the chunks are written in order.
+ *
+ * @param chunks The chunks, one per thread.
+ * @param threads The number of threads.
+ * @param buf The lines.
+ * @param len The number of chars, buf ends with a newline unless the
+ * input ends.
+ * @return void
+ */
+static void expand_lines(struct chunk *chunks, int threads, const char *buf,
+    size_t len)
+{
+    pthread_t tids[MAX_THREADS];
+    int started[MAX_THREADS];
+    struct iovec iov[MAX_THREADS];
+    size_t chunk_len = (len + (size_t) threads - 1) / (size_t) threads;
+    size_t done = 0;
+    int nchunks = 0, i;
+
+    if (chunk_len < MIN_CHUNK_SIZE) {
+        chunk_len = MIN_CHUNK_SIZE;
+    }
+
+    while (done < len) {
+        struct chunk *c = &chunks[nchunks];
+        size_t end = len;
+
+        /* The chunk ends behind the first newline after chunk_len chars */
+        if (nchunks < threads - 1 && len - done > chunk_len) {
+            const char *nl = memchr(buf + done + chunk_len - 1, '\n',
+                len - done - chunk_len + 1);
+
+            end = nl != NULL ? (size_t) (nl - buf) + 1 : len;
+        }
+        c->buf = buf + done;
+        c->len = end - done;
+        done = end;
+
+        /* The first chunk is expanded by the calling thread, so is every
+         * chunk that gets no thread. */
+        started[nchunks] = nchunks > 0
+            && pthread_create(&tids[nchunks], NULL, expand_chunk, c) == 0;
+        nchunks++;
+    }
+
+    for (i = 0; i < nchunks; i++) {
+        if (started[i]) {
+            (void) pthread_join(tids[i], NULL);
+        } else {
+            (void) expand_chunk(&chunks[i]);
+        }
+        iov[i].iov_base = chunks[i].out.buf;
+        iov[i].iov_len = chunks[i].out.len;
+    }
+
+    write_chunks(iov, nchunks);
+}
+
+/**
+ * Expands tabs to spaces with several threads (-j). The input is read in
+ * windows of CHUNK_SIZE chars per thread, the lines of a window are
+ * expanded by expand_lines() and the last line, which may go on, moves to
+ * the next window.
+ *
+ * @param fd The file descriptor of the input.
+ * @param stops The tab stops.
+ * @param threads The number of threads.
+ * @param mode MODE_EXPAND, or MODE_LEADING and MODE_ALL for -u and -a.
  * @return void
  */
-static void expand (FILE *fp, int tabstop)
+static void expand_parallel(int fd, const struct tab_stops *stops,
+    int threads, int mode)
 {
-    /* p Next multiple of tabstop.
-     * x Current index in line.
-     * i Helper for counting.
-     * c Current character from input stream.
-     */
-    int p, x = 0, i;
-    char c;
+    struct chunk chunks[MAX_THREADS];
+    size_t size = (size_t) threads * CHUNK_SIZE, have = 0;
+    char *buf = malloc(size + SHORT_SPAN), *grown;
+    int eof, i;
+
+    if (buf == NULL) {
+        bail_out(EXIT_FAILURE, "Out of memory.\n");
+    }
+    for (i = 0; i < threads; i++) {
+        chunks[i].stops = stops;
+        chunks[i].mode = mode;
+        chunks[i].out.fd = -1;
+        chunks[i].out.len = 0;
+        chunks[i].out.size = 0;
+        chunks[i].out.buf = NULL;
+    }
+
+    /* The output of the files before goes first */
+    flush_output(&output);
+
+    do {
+        size_t n = read_fully(fd, buf + have, size - have), cut;
+
+        eof = n < size - have;
+        have += n;
+        cut = have;
+        if (!eof) {
+            const char *nl = memrchr(buf, '\n', have);
 
-    while((c = fgetc(fp)) != EOF) {
-        if(c == '\t') {
-            p = tabstop * ((x / tabstop) + 1);
-//            printf("Tabstop t: %d, p: %d, x: %d\n", tabstop, p, x);
-            /* Insert spaces. */
-            for(i = 0; i < (p-x); i++) {
-                fprintf(stdout, " ");
+            if (nl == NULL) {
+                /* A line longer than the window, make it larger */
+                size *= 2;
+                if ((grown = realloc(buf, size + SHORT_SPAN)) == NULL) {
+                    bail_out(EXIT_FAILURE, "Out of memory.\n");
+                }
+                buf = grown;
+                continue;
             }
-            x = p;
+            cut = (size_t) (nl - buf) + 1;
+        }
+
+        expand_lines(chunks, threads, buf, cut);
+        (void) memmove(buf, buf + cut, have - cut);
+        have -= cut;
+    } while (!eof);
+
+    for (i = 0; i < threads; i++) {
+        free(chunks[i].out.buf);
+    }
+    free(buf);
+}
+
+/**
+ * Chooses how input without tabs is passed through to stdout. Only a
+ * pipe gets it spliced by default. Into a regular file the kernel copy
+ * is slower than writing the mapping on ext4, so copy_file_range(2) has
+ * to be asked for with the environment variable MYEXPAND_IO=copy.
+ * MYEXPAND_IO=read turns passing through off.
+ *
+ * @return void
+ */
+static void select_output(void)
+{
+    const char *force = getenv("MYEXPAND_IO");
+    struct stat st;
+    int flags;
+
+    if (force != NULL && strcmp(force, "read") == 0) {
+        read_only = 1;
+        return;
+    }
+    if (fstat(STDOUT_FILENO, &st) < 0) {
+        return;
+    }
+    if (S_ISFIFO(st.st_mode)) {
+        out_kind = OUT_PIPE;
+    } else if (force != NULL && strcmp(force, "copy") == 0
+        && S_ISREG(st.st_mode)
+        && (flags = fcntl(STDOUT_FILENO, F_GETFL)) >= 0
+        && (flags & O_APPEND) == 0) {
+        out_kind = OUT_FILE;
+    }
+}
+
+/**
+ * Drops chars of a pipe that were peeked at and expanded in userspace.
+ *
+ * @param src The input.
+ * @param len The number of chars.
+ * @return void
+ */
+static void drop_input(struct source *src, size_t len)
+{
+    static char scratch[4096];
+
+    src->off += (loff_t) len;
+    while (src->map == NULL && len > 0) {
+        ssize_t n = -1;
+
+        if (dev_null >= 0) {
+            n = splice(src->fd, NULL, dev_null, NULL, len, 0);
+        }
+        if (n < 0 && errno != EINTR) {
+            /* Without a /dev/null that splices the chars are read */
+            dev_null = -1;
+            n = read(src->fd, scratch, len < sizeof(scratch)
+                ? len : sizeof(scratch));
+        }
+        if (n == 0 || (n < 0 && errno != EINTR)) {
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        if (n > 0) {
+            len -= (size_t) n;
         }
-        else {
-            if( fputc(c, stdout) == EOF) {
+    }
+}
+
+/**
+ * Passes chars without tabs through to stdout, the output buffer is
+ * written first. The kernel copies them (copy_file_range(2) or
+ * splice(2)), or they are written from the mapping or from the peeked
+ * chars if it can't.
+ *
+ * @param src The input.
+ * @param buf The chars, mapped or peeked at.
+ * @param len The number of chars.
+ * @return void
+ */
+static void pass_through(struct source *src, const char *buf, size_t len)
+{
+    flush_output(&output);
+
+    while (len > 0 && out_kind != OUT_COPY) {
+        loff_t *off = src->map != NULL ? &src->off : NULL;
+        ssize_t n;
+
+        if (src->map != NULL && out_kind == OUT_FILE) {
+            n = copy_file_range(src->fd, off, STDOUT_FILENO, NULL, len, 0);
+        } else {
+            n = splice(src->fd, off, STDOUT_FILENO, NULL, len, SPLICE_F_MORE);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            /* Not for this kind of input or output, write from now on */
+            if (n < 0 && errno != EINVAL && errno != EXDEV
+                && errno != ENOSYS && errno != EBADF && errno != EOPNOTSUPP) {
                 bail_out(EXIT_FAILURE, "Couldn't write to stdout.\n");
             }
-            /* Check for NewLine. */ 
-            if(c == '\n') {
-                x = 0;
-            } else {
-                x++;
+            out_kind = OUT_COPY;
+            break;
+        }
+        if (off == NULL) {
+            src->off += n;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+
+    if (len > 0) {
+        write_all(STDOUT_FILENO, buf, len);
+        drop_input(src, len);
+    }
+}
+
+/**
+ * Returns the column behind chars without tabs.
+ *
+ * @param buf The chars.
+ * @param len The number of chars.
+ * @param col The column of the first char.
+ * @return The column of the char after them.
+ */
+static size_t skip_columns(const char *buf, size_t len, size_t col)
+{
+    const char *nl = memrchr(buf, '\n', len);
+
+    if (nl != NULL) {
+        col = 0;
+        len = (size_t) (buf + len - nl - 1);
+        buf = nl + 1;
+    }
+
+    return col + (is_ascii(buf, len) ? len : text_width(buf, len));
+}
+
+/**
+ * Expands a part of the input. Windows without a tab extend the stretch
+ * that is passed through, a window with a tab is expanded from the tab
+ * on. Stretches shorter than PASS_MIN are copied into the output buffer.
+ * Windows end at the start of UTF-8 sequences. SHORT_SPAN chars behind
+ * buf have to be readable.
+ *
+ * @param src The input, buf starts at src->off.
+ * @param buf The chars, mapped or peeked at.
+ * @param len The number of chars.
+ * @param col The column of the first char.
+ * @param stops The tab stops.
+ * @return The column of the char after the part.
+ */
+static size_t expand_region(struct source *src, const char *buf,
+    size_t len, size_t col, const struct tab_stops *stops)
+{
+    /* The pass chars in front of pos have no tabs and are not written */
+    size_t pos = 0, pass = 0;
+
+    while (pos < len) {
+        size_t n = len - pos > PASS_WINDOW
+            ? char_boundary(buf + pos, PASS_WINDOW) : len - pos;
+        const char *tab = memchr(buf + pos, '\t', n);
+        size_t head = tab != NULL ? (size_t) (tab - buf) - pos : n;
+
+        pass += head;
+        pos += head;
+        if (tab == NULL) {
+            continue;
+        }
+
+        col = skip_columns(buf + pos - pass, pass, col);
+        if (pass >= PASS_MIN) {
+            pass_through(src, buf + pos - pass, pass);
+        } else {
+            put_chars(&output, buf + pos - pass, pass);
+            drop_input(src, pass);
+        }
+        pass = 0;
+
+        col = expand_text(&output, buf + pos, n - head, col, stops);
+        drop_input(src, n - head);
+        pos += n - head;
+    }
+
+    col = skip_columns(buf + pos - pass, pass, col);
+    if (pass >= PASS_MIN) {
+        pass_through(src, buf + pos - pass, pass);
+    } else {
+        put_chars(&output, buf + pos - pass, pass);
+        drop_input(src, pass);
+    }
+
+    return col;
+}
+
+/**
+ * Expands a regular file through a mapping of it, from the file position
+ * on. The file position is moved to the end afterwards, like reading
+ * would.
+ *
+ * @param fd The file descriptor of the file.
+ * @param size The size of the file.
+ * @param stops The tab stops.
+ * @return 0, -1 if the file can't be mapped
+ */
+static int expand_mapped(int fd, size_t size,
+    const struct tab_stops *stops)
+{
+    struct source src;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    size_t start, head, col;
+    void *map;
+
+    if (pos < 0) {
+        return -1;
+    }
+    start = (uintmax_t) pos < size ? (size_t) pos : size;
+    if (start == size) {
+        return 0;
+    }
+    if ((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0))
+        == MAP_FAILED) {
+        return -1;
+    }
+    (void) madvise(map, size, MADV_SEQUENTIAL);
+    src.fd = fd;
+    src.map = map;
+    src.off = (loff_t) start;
+
+    /* The last chars are expanded from a copy, the mapping has no slack */
+    head = size - start > SHORT_SPAN ? size - SHORT_SPAN : start;
+    head = start + char_boundary(src.map + start, head - start);
+    col = expand_region(&src, src.map + start, head - start, 0, stops);
+    (void) memcpy(in_buf, src.map + head, size - head);
+    (void) expand_text(&output, in_buf, size - head, col, stops);
+
+    (void) munmap(map, size);
+    (void) lseek(fd, (off_t) size, SEEK_SET);
+
+    return 0;
+}
+
+/**
+ * Expands a pipe. The chars in the pipe are peeked at with tee(2), then
+ * passed through or dropped after they are expanded.
+ *
+ * @param fd The file descriptor of the pipe.
+ * @param stops The tab stops.
+ * @return 0, -1 if the pipe can't be peeked at
+ */
+static int expand_pipe(int fd, const struct tab_stops *stops)
+{
+    struct source src;
+    int peek[2];
+    size_t col = 0;
+    struct utf8_carry carry = { { 0 }, 0, 0 };
+
+    if (pipe(peek) < 0) {
+        return -1;
+    }
+    /* Both pipes should hold a whole input buffer */
+    (void) fcntl(peek[1], F_SETPIPE_SZ, IN_BUF_SIZE);
+    if (fcntl(fd, F_GETPIPE_SZ) < IN_BUF_SIZE) {
+        (void) fcntl(fd, F_SETPIPE_SZ, IN_BUF_SIZE);
+    }
+    if (dev_null < 0) {
+        dev_null = open("/dev/null", O_WRONLY);
+    }
+    src.fd = fd;
+    src.map = NULL;
+    src.off = 0;
+
+    for (;;) {
+        ssize_t n = tee(fd, peek[1], IN_BUF_SIZE, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && src.off == 0) {
+            (void) close(peek[0]);
+            (void) close(peek[1]);
+            return -1;
+        }
+        if (n < 0) {
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        if (n == 0) {
+            break;
+        }
+        if (read_fully(peek[0], in_buf, (size_t) n) != (size_t) n) {
+            bail_out(EXIT_FAILURE, "Couldn't read input.\n");
+        }
+        col = finish_char(&carry, in_buf, (size_t) n, col);
+        col = expand_region(&src, in_buf, (size_t) n, col, stops);
+        keep_tail(&carry, in_buf, (size_t) n);
+    }
+
+    (void) close(peek[0]);
+    (void) close(peek[1]);
+
+    return 0;
+}
+
+/**
+ * Expands tabs to spaces. Files and pipes are passed through where they
+ * have no tabs, everything else is read.
+ *
+ * @param fd The file descriptor of the input.
+ * @param stops The tab stops.
+ * @return void
+ */
+static void expand(int fd, const struct tab_stops *stops)
+{
+    struct stat st;
+
+    if (!read_only && fstat(fd, &st) == 0) {
+        if (S_ISREG(st.st_mode) && st.st_size > 0
+            && (uintmax_t) st.st_size <= SIZE_MAX
+            && expand_mapped(fd, (size_t) st.st_size, stops) == 0) {
+            return;
+        }
+        if (S_ISFIFO(st.st_mode) && out_kind != OUT_COPY
+            && expand_pipe(fd, stops) == 0) {
+            return;
+        }
+    }
+    expand_read(fd, stops);
+}
+
+/**
+ * Adds the tab stops of one -t to the list. The values are separated by
+ * commas or blanks, the last one may have a '/' in front for a stop at
+ * every multiple of it or a '+' for a stop every that many columns behind
+ * the last stop of the list.
+ *
+ * @param stops The tab stops.
+ * @param arg The argument of -t.
+ * @return void
+ */
+static void add_tab_stops(struct tab_stops *stops, const char *arg)
+{
+    while (*arg != '\0') {
+        unsigned long value;
+        char *end;
+        int tail = 0;
+
+        if (*arg == ',' || isblank((unsigned char) *arg)) {
+            arg++;
+            continue;
+        }
+        if (*arg == '/' || *arg == '+') {
+            tail = *arg++;
+        }
+        if (!isdigit((unsigned char) *arg)) {
+            bail_out(EXIT_FAILURE, "Usage: %s [-u | -a] [-t tablist] [-j threads] [file ...]\n", pgm_name);
+        }
+        errno = 0;
+        value = strtoul(arg, &end, 10);
+        if (errno != 0 || value > MAX_TAB_STOP) {
+            bail_out(EXIT_FAILURE, "Converting tabstop to int failed.\n");
+        }
+        arg = end;
+
+        if (value == 0) {
+            bail_out(EXIT_FAILURE, "Tab stops can't be 0.\n");
+        }
+        if (stops->tail != 0) {
+            bail_out(EXIT_FAILURE, "Only the last tab stop can have a '/' or '+'.\n");
+        }
+        if (tail != 0) {
+            stops->tail = tail;
+            stops->step = value;
+            continue;
+        }
+        if (stops->count > 0 && value <= stops->list[stops->count - 1]) {
+            bail_out(EXIT_FAILURE, "Tab stops have to be ascending.\n");
+        }
+        if ((stops->count & (stops->count - 1)) == 0) {
+            size_t *grown = realloc(stops->list,
+                (stops->count > 0 ? 2 * stops->count : 1) * sizeof(size_t));
+
+            if (grown == NULL) {
+                bail_out(EXIT_FAILURE, "Out of memory.\n");
             }
+            stops->list = grown;
+        }
+        stops->list[stops->count++] = value;
+    }
+}
+
+/**
+ * Sets up the stops behind the list and the table of next stops once all
+ * -t are added. A single value is the distance of all stops, without -t
+ * it is 8. Behind the last stop of a longer list without '/' or '+' a tab
+ * is a single space.
+ *
+ * @param stops The tab stops.
+ * @return void
+ */
+static void finish_tab_stops(struct tab_stops *stops)
+{
+    size_t col;
+
+    if (stops->tail == 0) {
+        if (stops->count <= 1) {
+            stops->step = stops->count == 1 ? stops->list[0] : 8;
+            stops->count = 0;
+        } else {
+            stops->step = 1;
         }
     }
+    stops->end = stops->count > 0 ? stops->list[stops->count - 1] : 0;
+    stops->base = stops->tail == '/'
+        ? stops->end / stops->step * stops->step : stops->end;
+
+    for (col = 0; col < TAB_COLUMNS; col++) {
+        stops->next[col] = far_stop(stops, col);
+    }
 }
 
 /**
@@ -92,49 +2220,72 @@ static void expand (FILE *fp, int tabstop)
  */
 int main(int argc, char** argv)
 {
-    int opt, tabs=8, i = 0;
-    FILE *fp;
+    int opt, threads = 1, mode = MODE_EXPAND, i = 0, fd;
     
     (void) atexit (cleanup);
 
     /* Set the name of the program */
     pgm_name = argv[0];
+    select_expand_block();
+    select_output();
 
-    while ((opt = getopt(argc, argv, "t:")) != -1) {
+    while ((opt = getopt(argc, argv, "uat:j:")) != -1) {
         switch (opt) {
+        case 'u':
+            /* The last of -u and -a counts */
+            mode = MODE_LEADING;
+            break;
+        case 'a':
+            mode = MODE_ALL;
+            break;
         case 't':
+            add_tab_stops(&tab_stops, optarg);
+            break;
+        case 'j':
             if(optarg && isdigit(*optarg)) {
-                tabs = strtol(optarg, NULL, 10); /* Convert char* to number */
-                if ((errno == ERANGE &&
-                        (tabs == LONG_MAX || tabs == LONG_MIN))
-                    || (errno != 0 && tabs == 0)) {
-                    bail_out(EXIT_FAILURE, "Converting tabstop to int failed.\n");
-                }
+                threads = strtol(optarg, NULL, 10);
             } else {
-                 bail_out(EXIT_FAILURE, "Usage: %s [-t tabstop] [file ...]\n", pgm_name);
+                threads = 0;
+            }
+            if (threads < 1 || threads > MAX_THREADS) {
+                bail_out(EXIT_FAILURE, "Usage: %s [-u | -a] [-t tablist] [-j threads] [file ...]\n", pgm_name);
             }
             break;
         default: /* '?' */
-           bail_out(EXIT_FAILURE, "Usage: %s [-t tabstop] [file ...]\n", pgm_name);
+           bail_out(EXIT_FAILURE, "Usage: %s [-u | -a] [-t tablist] [-j threads] [file ...]\n", pgm_name);
         }
     }
+    finish_tab_stops(&tab_stops);
     
     /* IF optind is smaller than argc parse on ELSE use stdin */
     if(optind < argc) {
         //printf("optind < argc\n");
         for(i = (optind); i < argc; i++) {
             //printf("ARGV [%i]: %s\n", i, argv[i]);
-            if( ((fp = fopen((char*)(argv[i]), "r")) == NULL)) {
+            if( ((fd = open(argv[i], O_RDONLY)) < 0)) {
                bail_out(EXIT_FAILURE, "Error opening file.\n"); 
             }
-            (void)expand(fp, tabs);
-            if( (fclose(fp) == EOF )) {
+            if (threads > 1) {
+                expand_parallel(fd, &tab_stops, threads, mode);
+            } else if (mode != MODE_EXPAND) {
+                unexpand(fd, &tab_stops, mode == MODE_ALL);
+            } else {
+                (void)expand(fd, &tab_stops);
+            }
+            if( (close(fd) < 0 )) {
                 bail_out(EXIT_FAILURE, "Closing stream failed.\n");
             }
         }
     } else {
-        (void)expand(stdin, tabs);
+        if (threads > 1) {
+            expand_parallel(STDIN_FILENO, &tab_stops, threads, mode);
+        } else if (mode != MODE_EXPAND) {
+            unexpand(STDIN_FILENO, &tab_stops, mode == MODE_ALL);
+        } else {
+            (void)expand(STDIN_FILENO, &tab_stops);
+        }
     }
+    flush_output(&output);
 
     exit(EXIT_SUCCESS);
 }